@@ -1,57 +0,0 @@
-/*
-  ISC License
-
-  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
-
-  Permission to use, copy, modify, and/or distribute this software for any
-  purpose with or without fee is hereby granted, provided that the above
-  copyright notice and this permission notice appear in all copies.
-
-  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
-  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
-  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
-  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
-  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
-  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
-  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
-*/
-
-#include "copy_stream.hpp"
-
-#include "error.hpp"
-
-#include <array>
-#include <algorithm>
-#include <iostream>
-
-namespace util
-{
-  void
-  copy_stream(std::istream &is_,
-              std::ostream &os_,
-              std::size_t   len_)
-  {
-    std::size_t bytes_to_read;
-    std::size_t bytes_to_write;
-    std::array<char,4096> buf;
-
-    bytes_to_write = len_;
-    do
-      {
-        bytes_to_read = std::min(buf.size(),bytes_to_write);
-
-        is_.read(&buf[0],bytes_to_read);
-
-        os_.write(&buf[0],is_.gcount());
-
-        bytes_to_write -= is_.gcount();
-      }
-    while(is_ && os_ && (bytes_to_write > 0));
-
-    if(bytes_to_write > 0)
-      throw Error("copy_stream: short copy, " +
-                  std::to_string(bytes_to_write) +
-                  " of " + std::to_string(len_) +
-                  " bytes not transferred");
-  }
-}
@@ -0,0 +1,284 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "file_copier.hpp"
+
+#include "error.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+  constexpr u64 BUF_SIZE  = (1024 * 1024);
+  constexpr u64 BUF_ALIGN = 4096;
+
+#if defined(__linux__)
+  // Errors meaning the kernel cannot copy between these two files
+  // rather than that the copy itself failed.
+  static
+  bool
+  kernel_copy_unsupported(const int errno_)
+  {
+    switch(errno_)
+      {
+      case EXDEV:
+      case ENOSYS:
+      case EINVAL:
+      case EOPNOTSUPP:
+#if defined(ENOTSUP) && (ENOTSUP != EOPNOTSUPP)
+      case ENOTSUP:
+#endif
+        return true;
+      default:
+        return false;
+      }
+  }
+#endif
+}
+
+namespace util
+{
+  FileCopier::FileCopier(const std::filesystem::path &dst_path_,
+                         std::ostream                &dst_)
+    : _os(dst_),
+      _fd(-1)
+  {
+#if defined(__linux__)
+    // Readable too so replicas can be copied from the first one.
+    _fd = ::open(dst_path_.c_str(),O_RDWR|O_CLOEXEC);
+#else
+    (void)dst_path_;
+#endif
+  }
+
+  FileCopier::~FileCopier()
+  {
+#if defined(__linux__)
+    if(_fd >= 0)
+      ::close(_fd);
+#endif
+  }
+
+  bool
+  FileCopier::clone(const std::filesystem::path &src_path_)
+  {
+#if defined(__linux__) && defined(FICLONE)
+    int rv;
+    int src_fd;
+
+    if(_fd < 0)
+      return false;
+
+    src_fd = ::open(src_path_.c_str(),O_RDONLY|O_CLOEXEC);
+    if(src_fd < 0)
+      throw Error("failed to open input file: " + src_path_.string());
+
+    rv = ::ioctl(_fd,FICLONE,src_fd);
+    ::close(src_fd);
+
+    return (rv == 0);
+#else
+    (void)src_path_;
+    return false;
+#endif
+  }
+
+  void
+  FileCopier::copy(const std::filesystem::path &src_path_,
+                   const u64                    src_offset_,
+                   const u64                    len_,
+                   const std::vector<u64>      &dst_offsets_)
+  {
+    std::ifstream is;
+
+    if((len_ == 0) || dst_offsets_.empty())
+      return;
+
+#if defined(__linux__)
+    if(_fd >= 0)
+      {
+        int src_fd;
+        bool copied;
+
+        src_fd = ::open(src_path_.c_str(),O_RDONLY|O_CLOEXEC);
+        if(src_fd < 0)
+          throw Error("failed to open input file: " + src_path_.string());
+
+        try
+          {
+            const u64 first = dst_offsets_[0];
+
+            copied = _kernel_copy(src_fd,src_path_,src_offset_,len_,first);
+            for(u64 i = 1; copied && (i < dst_offsets_.size()); i++)
+              copied = _kernel_copy(_fd,src_path_,first,len_,dst_offsets_[i]);
+          }
+        catch(...)
+          {
+            ::close(src_fd);
+            throw;
+          }
+        ::close(src_fd);
+
+        if(copied)
+          return;
+
+        // The output's filesystem can do neither so don't try again.
+        ::close(_fd);
+        _fd = -1;
+      }
+#endif
+
+    is.open(src_path_,std::ios::binary);
+    if(!is)
+      throw Error("failed to open input file: " + src_path_.string());
+    is.seekg(static_cast<std::streamoff>(src_offset_),std::ios::beg);
+
+    auto read = [&](char *buf_, const u64 pos_, const u64 size_)
+    {
+      is.read(buf_,size_);
+      if(is.bad())
+        throw Error("read error on input file: " + src_path_.string());
+      if(static_cast<u64>(is.gcount()) != size_)
+        throw Error("short copy, " + std::to_string(len_ - pos_) +
+                    " of " + std::to_string(len_) +
+                    " bytes not transferred from " + src_path_.string());
+    };
+
+    copy(read,src_path_,len_,dst_offsets_);
+  }
+
+  // Returns false when the kernel can not copy between the two files
+  // at all. Whatever was written is rewritten by the buffered path.
+  bool
+  FileCopier::_kernel_copy(const int                    src_fd_,
+                           const std::filesystem::path &src_path_,
+                           const u64                    src_offset_,
+                           const u64                    len_,
+                           const u64                    dst_offset_)
+  {
+#if defined(__linux__)
+    loff_t in_off;
+    loff_t out_off;
+    u64 bytes_left;
+    bool use_sendfile;
+
+    in_off       = src_offset_;
+    out_off      = dst_offset_;
+    bytes_left   = len_;
+    use_sendfile = false;
+    while(bytes_left > 0)
+      {
+        ssize_t rv;
+        const size_t n = std::min<u64>(bytes_left,0x7FFFF000);
+
+        if(!use_sendfile)
+          {
+            rv = ::copy_file_range(src_fd_,&in_off,_fd,&out_off,n,0);
+            if((rv < 0) && kernel_copy_unsupported(errno))
+              {
+                use_sendfile = true;
+                continue;
+              }
+          }
+        else
+          {
+            if(::lseek(_fd,out_off,SEEK_SET) < 0)
+              throw Error("failed to seek output image while writing " +
+                          src_path_.string());
+
+            rv = ::sendfile(_fd,src_fd_,&in_off,n);
+            if((rv < 0) && kernel_copy_unsupported(errno))
+              return false;
+            if(rv > 0)
+              out_off += rv;
+          }
+
+        if((rv < 0) && (errno == EINTR))
+          continue;
+        if(rv < 0)
+          throw Error("failed to write file data for " +
+                      src_path_.string() + ": " + std::strerror(errno));
+        if(rv == 0)
+          throw Error("short copy, " + std::to_string(bytes_left) +
+                      " of " + std::to_string(len_) +
+                      " bytes not transferred from " + src_path_.string());
+
+        bytes_left -= rv;
+      }
+
+    return true;
+#else
+    (void)src_fd_;
+    (void)src_path_;
+    (void)src_offset_;
+    (void)len_;
+    (void)dst_offset_;
+    return false;
+#endif
+  }
+
+  void
+  FileCopier::copy(const ReadFunc              &read_,
+                   const std::filesystem::path &src_name_,
+                   const u64                    len_,
+                   const std::vector<u64>      &dst_offsets_)
+  {
+    char *buf;
+
+    if((len_ == 0) || dst_offsets_.empty())
+      return;
+
+    if(_buf.empty())
+      _buf.resize(BUF_SIZE + BUF_ALIGN);
+    buf = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(_buf.data()) +
+                                   (BUF_ALIGN - 1)) & ~(BUF_ALIGN - 1));
+
+    for(u64 pos = 0; pos < len_;)
+      {
+        const u64 n = std::min(BUF_SIZE,len_ - pos);
+
+        read_(buf,pos,n);
+
+        for(const auto offset : dst_offsets_)
+          {
+            _os.seekp(static_cast<std::streamoff>(offset + pos),std::ios::beg);
+            if(!_os)
+              throw Error("failed to seek output image while writing " +
+                          src_name_.string());
+            _os.write(buf,n);
+            if(_os.fail())
+              throw Error("failed to write file data for " +
+                          src_name_.string());
+          }
+
+        pos += n;
+      }
+  }
+}
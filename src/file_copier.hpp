@@ -0,0 +1,85 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+namespace util
+{
+  // Copies whole source files into several offsets of one output
+  // file, reading each source once. On Linux the kernel moves the
+  // bytes with copy_file_range(2) or sendfile(2): the source goes to
+  // the first offset and the other replicas are copied from there
+  // within the output. Where neither works each source is read into
+  // a large aligned buffer and every replica is written from it.
+  class FileCopier
+  {
+  public:
+    // Fills buf with size bytes starting pos bytes into the source.
+    typedef std::function<void(char *buf, const u64 pos, const u64 size)> ReadFunc;
+
+  public:
+    // dst_ must already be open on dst_path_ and be flushed before
+    // copy() is called; the kernel path writes through its own
+    // descriptor.
+    FileCopier(const std::filesystem::path &dst_path,
+               std::ostream                &dst);
+    ~FileCopier();
+
+    FileCopier(const FileCopier&) = delete;
+    FileCopier& operator=(const FileCopier&) = delete;
+
+  public:
+    // Replaces the whole output with a reflink clone of src_path.
+    // Returns false where the platform or filesystem can't share
+    // extents; the output is then left as it was.
+    bool clone(const std::filesystem::path &src_path);
+
+  public:
+    // Copies len bytes of src_path starting at src_offset to each
+    // offset in dst_offsets.
+    void copy(const std::filesystem::path &src_path,
+              const u64                    src_offset,
+              const u64                    len,
+              const std::vector<u64>      &dst_offsets);
+    // Same but the bytes come from read_, for sources that are not a
+    // contiguous range of a file. src_name is used in errors.
+    void copy(const ReadFunc              &read,
+              const std::filesystem::path &src_name,
+              const u64                    len,
+              const std::vector<u64>      &dst_offsets);
+
+  private:
+    bool _kernel_copy(const int                    src_fd,
+                      const std::filesystem::path &src_path,
+                      const u64                    src_offset,
+                      const u64                    len,
+                      const u64                    dst_offset);
+
+  private:
+    std::ostream      &_os;
+    int                _fd;
+    std::vector<char>  _buf;
+  };
+}
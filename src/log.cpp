@@ -16,25 +16,62 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#include "log.hpp"
+
 #include "error.hpp"
 
+#include <cstdio>
 #include <filesystem>
+#include <string>
 
 namespace fs = std::filesystem;
 
+static thread_local std::string *t_warnings = nullptr;
+
 namespace Log
 {
-  void
-  error_stream_open(const fs::path &filepath_)
+  std::string
+  error_stream_open_str(const fs::path &filepath_)
   {
-    fprintf(stderr,"3dt: error opening file '%s'",
-            filepath_.filename().string().c_str());
+    std::string str;
+
+    str = "3dt: error opening file '" + filepath_.filename().string() + "'";
     if(!fs::exists(filepath_))
-      fprintf(stderr,": No such file or directory");
+      str += ": No such file or directory";
     else if(!fs::is_regular_file(filepath_))
-      fprintf(stderr,": not a regular file");
+      str += ": not a regular file";
+    str += "\n";
 
-    fprintf(stderr,"\n");
+    return str;
+  }
+
+  void
+  error_stream_open(const fs::path &filepath_)
+  {
+    fputs(error_stream_open_str(filepath_).c_str(),stderr);
+  }
+
+  void
+  warning(const std::string &msg_)
+  {
+    std::string str;
+
+    str = "3dt: warning: " + msg_ + "\n";
+    if(t_warnings)
+      t_warnings->append(str);
+    else
+      fputs(str.c_str(),stderr);
+  }
+
+  CaptureWarnings::CaptureWarnings(std::string *buf_)
+    : _prev(t_warnings)
+  {
+    t_warnings = buf_;
+  }
+
+  CaptureWarnings::~CaptureWarnings()
+  {
+    t_warnings = _prev;
   }
 
   void
@@ -21,9 +21,26 @@
 #include "error.hpp"
 
 #include <filesystem>
+#include <string>
 
 namespace Log
 {
   void error(const Error &err);
   void error_stream_open(const std::filesystem::path &filepath);
+  std::string error_stream_open_str(const std::filesystem::path &filepath);
+  void warning(const std::string &msg);
+
+  // While alive, warnings raised on the constructing thread are
+  // appended to buf instead of being written to stderr. Lets
+  // concurrent jobs keep lower level warnings with their own output.
+  // A null buf leaves warnings going to stderr.
+  class CaptureWarnings
+  {
+  public:
+    CaptureWarnings(std::string *buf);
+    ~CaptureWarnings();
+
+  private:
+    std::string *_prev;
+  };
 }
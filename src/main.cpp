@@ -112,9 +112,14 @@ _generate_identify_argparser(CLI::App          &app_,
 
   subcmd = app_.add_subcommand("identify","attempt to identify disc image");
   subcmd->add_option("filepaths",options_.filepaths)
-    ->description("path to disc images")
+    ->description("path to disc images, directories to search, or - to read paths from stdin")
     ->type_name("PATH")
-    ->check(CLI::ExistingFile)
+    ->check(CLI::Validator([](std::string &path_) -> std::string
+    {
+      if(path_ == "-")
+        return {};
+      return CLI::ExistingPath(path_);
+    },""))
     ->required();
   subcmd->add_option("-f,--format",options_.format)
     ->description("output format")
@@ -122,6 +127,13 @@ _generate_identify_argparser(CLI::App          &app_,
     ->default_val("human")
     ->take_last()
     ->check(CLI::IsMember({"human","csv"}));
+  subcmd->add_option("-j,--jobs",options_.jobs)
+    ->description("number of images to identify concurrently")
+    ->type_name("N")
+    ->default_val(1)
+    ->check(CLI::Range(1,1024));
+  subcmd->add_flag("--tiered",options_.tiered)
+    ->description("match on the disc label first and walk the filesystem only when needed");
 
   subcmd->callback([&options_]()
   {
@@ -135,6 +147,7 @@ _generate_unpack_argparser(CLI::App        &app_,
                            Options::Unpack &options_)
 {
   CLI::App *subcmd;
+  CLI::Option *jobs;
 
   subcmd = app_.add_subcommand("unpack","unpack disc image");
   subcmd->add_option("<filepaths>",options_.filepaths)
@@ -158,6 +171,19 @@ _generate_unpack_argparser(CLI::App        &app_,
     ->type_name("PATH")
     ->default_val("")
     ->take_last();
+  jobs = subcmd->add_option("-j,--jobs",options_.jobs)
+    ->description("number of files to extract concurrently")
+    ->type_name("N")
+    ->default_val(1)
+    ->check(CLI::Range(1,1024));
+  subcmd->add_option("--max-memory",options_.max_memory)
+    ->description("memory cap in MiB for extraction buffers and queue or the read window")
+    ->type_name("MiB")
+    ->default_val(64)
+    ->check(CLI::Range(1,65536));
+  subcmd->add_flag("--disc-order",options_.disc_order)
+    ->description("extract files in on-disc order using large sequential reads")
+    ->excludes(jobs);
 
   subcmd->callback([&options_]()
   {
@@ -315,6 +341,8 @@ _generate_to_iso_argparser(CLI::App       &app_,
     ->type_name("PATH");
   subcmd->add_flag("--force",options_.force)
     ->description("overwrite output file if it already exists");
+  subcmd->add_flag("--no-progress{false}",options_.progress)
+    ->description("do not print conversion progress");
 
   subcmd->callback([&options_]()
   {
@@ -371,6 +399,11 @@ _generate_verify_argparser(CLI::App        &app_,
     ->description("print only per-image verification status");
   subcmd->add_flag("-v,--verbose",opts_.verbose)
     ->description("print detailed verification output");
+  subcmd->add_option("-j,--jobs",opts_.jobs)
+    ->description("number of images to verify concurrently")
+    ->type_name("N")
+    ->default_val(1)
+    ->check(CLI::Range(1,1024));
 
   subcmd->callback([&opts_]()
   {
@@ -0,0 +1,397 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#include <cstddef>
+
+namespace Montgomery
+{
+  // Fixed width unsigned integer stored as little-endian 32 bit limbs.
+  // Everything lives on the stack; there is no allocation anywhere in
+  // this header.
+  template<std::size_t LIMBS>
+  struct UInt
+  {
+    u32 limbs[LIMBS];
+  };
+
+  using UInt256 = UInt<8>;
+  using UInt512 = UInt<16>;
+
+  template<std::size_t LIMBS>
+  UInt<LIMBS>
+  zero()
+  {
+    UInt<LIMBS> rv = {};
+
+    return rv;
+  }
+
+  template<std::size_t LIMBS>
+  UInt<LIMBS>
+  one()
+  {
+    UInt<LIMBS> rv = {};
+
+    rv.limbs[0] = 1;
+
+    return rv;
+  }
+
+  // Big-endian octets. Octets above the width of the integer must be
+  // zero and are ignored.
+  template<std::size_t LIMBS>
+  UInt<LIMBS>
+  from_octets(const unsigned char *octets_,
+              const std::size_t    size_)
+  {
+    UInt<LIMBS> rv = {};
+
+    for(std::size_t i = 0; i < size_; i++)
+      {
+        const std::size_t limb = (i / 4);
+
+        if(limb >= LIMBS)
+          break;
+        rv.limbs[limb] |= ((u32)octets_[size_ - 1 - i] << (8 * (i % 4)));
+      }
+
+    return rv;
+  }
+
+  template<std::size_t LIMBS>
+  void
+  to_octets(const UInt<LIMBS> &x_,
+            unsigned char     *octets_,
+            const std::size_t  size_)
+  {
+    for(std::size_t i = 0; i < size_; i++)
+      {
+        const std::size_t limb = (i / 4);
+
+        octets_[size_ - 1 - i] =
+          ((limb < LIMBS) ? (u8)(x_.limbs[limb] >> (8 * (i % 4))) : 0);
+      }
+  }
+
+  template<std::size_t LIMBS>
+  int
+  compare(const UInt<LIMBS> &a_,
+          const UInt<LIMBS> &b_)
+  {
+    for(std::size_t i = LIMBS; i-- > 0;)
+      {
+        if(a_.limbs[i] < b_.limbs[i])
+          return -1;
+        if(a_.limbs[i] > b_.limbs[i])
+          return 1;
+      }
+
+    return 0;
+  }
+
+  // a_ += b_, returns the carry out.
+  template<std::size_t LIMBS>
+  u32
+  add(UInt<LIMBS>       &a_,
+      const UInt<LIMBS> &b_)
+  {
+    u64 c = 0;
+
+    for(std::size_t i = 0; i < LIMBS; i++)
+      {
+        c += (u64)a_.limbs[i] + b_.limbs[i];
+        a_.limbs[i] = (u32)c;
+        c >>= 32;
+      }
+
+    return (u32)c;
+  }
+
+  // a_ -= b_, returns the borrow out.
+  template<std::size_t LIMBS>
+  u32
+  sub(UInt<LIMBS>       &a_,
+      const UInt<LIMBS> &b_)
+  {
+    u32 borrow = 0;
+
+    for(std::size_t i = 0; i < LIMBS; i++)
+      {
+        const u64 d = ((u64)a_.limbs[i] - b_.limbs[i] - borrow);
+
+        a_.limbs[i] = (u32)d;
+        borrow = (u32)(d >> 63);
+      }
+
+    return borrow;
+  }
+
+  // Zero extends x_ to twice its width.
+  template<std::size_t LIMBS>
+  UInt<LIMBS * 2>
+  widen(const UInt<LIMBS> &x_)
+  {
+    UInt<LIMBS * 2> rv = {};
+
+    for(std::size_t i = 0; i < LIMBS; i++)
+      rv.limbs[i] = x_.limbs[i];
+
+    return rv;
+  }
+
+  // Full schoolbook product.
+  template<std::size_t LIMBS>
+  UInt<LIMBS * 2>
+  multiply(const UInt<LIMBS> &a_,
+           const UInt<LIMBS> &b_)
+  {
+    UInt<LIMBS * 2> rv = {};
+
+    for(std::size_t i = 0; i < LIMBS; i++)
+      {
+        u64 c = 0;
+
+        for(std::size_t j = 0; j < LIMBS; j++)
+          {
+            c += (rv.limbs[i + j] + ((u64)a_.limbs[j] * b_.limbs[i]));
+            rv.limbs[i + j] = (u32)c;
+            c >>= 32;
+          }
+        rv.limbs[i + LIMBS] = (u32)c;
+      }
+
+    return rv;
+  }
+
+  // Arithmetic modulo a fixed odd modulus using Montgomery
+  // multiplication with R = 2^(32 * LIMBS). Values passed to and
+  // returned from the public functions other than mul() and
+  // to_mont()/from_mont() are in the normal domain. Immutable after
+  // construction so a single instance can be shared across threads.
+  template<std::size_t LIMBS>
+  class Modulus
+  {
+  public:
+    using Int = UInt<LIMBS>;
+
+  public:
+    explicit
+    Modulus(const Int &modulus_)
+      : _m(modulus_)
+    {
+      // -m^-1 mod 2^32 by Newton iteration; each step doubles the
+      // number of correct low bits.
+      u32 inv = 1;
+      for(int i = 0; i < 5; i++)
+        inv *= (2 - (_m.limbs[0] * inv));
+      _m0inv = (0 - inv);
+
+      // R^2 mod m by doubling 1 a total of 2 * 32 * LIMBS times.
+      _r2 = one<LIMBS>();
+      for(std::size_t i = 0; i < (2 * 32 * LIMBS); i++)
+        {
+          const u32 carry = add(_r2,_r2);
+
+          if(carry || (compare(_r2,_m) >= 0))
+            sub(_r2,_m);
+        }
+    }
+
+  public:
+    const Int&
+    modulus() const
+    {
+      return _m;
+    }
+
+    // a_ * b_ * R^-1 mod m. Any inputs below R are accepted.
+    Int
+    mul(const Int &a_,
+        const Int &b_) const
+    {
+      u32 t[LIMBS + 2] = {};
+
+      for(std::size_t i = 0; i < LIMBS; i++)
+        {
+          u64 c = 0;
+
+          for(std::size_t j = 0; j < LIMBS; j++)
+            {
+              c += (t[j] + ((u64)a_.limbs[j] * b_.limbs[i]));
+              t[j] = (u32)c;
+              c >>= 32;
+            }
+          c += t[LIMBS];
+          t[LIMBS]     = (u32)c;
+          t[LIMBS + 1] = (u32)(c >> 32);
+
+          const u32 q = (t[0] * _m0inv);
+
+          c = (t[0] + ((u64)q * _m.limbs[0]));
+          c >>= 32;
+          for(std::size_t j = 1; j < LIMBS; j++)
+            {
+              c += (t[j] + ((u64)q * _m.limbs[j]));
+              t[j - 1] = (u32)c;
+              c >>= 32;
+            }
+          c += t[LIMBS];
+          t[LIMBS - 1] = (u32)c;
+          t[LIMBS]     = (t[LIMBS + 1] + (u32)(c >> 32));
+        }
+
+      return _finish(t,t[LIMBS]);
+    }
+
+    Int
+    to_mont(const Int &x_) const
+    {
+      return mul(x_,_r2);
+    }
+
+    Int
+    from_mont(const Int &x_) const
+    {
+      return mul(x_,one<LIMBS>());
+    }
+
+    // x_ mod m for a double width x_ that is below m * R.
+    Int
+    reduce(const UInt<LIMBS * 2> &x_) const
+    {
+      u32 t[(LIMBS * 2) + 1];
+
+      for(std::size_t i = 0; i < (LIMBS * 2); i++)
+        t[i] = x_.limbs[i];
+      t[LIMBS * 2] = 0;
+
+      for(std::size_t i = 0; i < LIMBS; i++)
+        {
+          const u32 q = (t[i] * _m0inv);
+          u64 c = 0;
+
+          for(std::size_t j = 0; j < LIMBS; j++)
+            {
+              c += (t[i + j] + ((u64)q * _m.limbs[j]));
+              t[i + j] = (u32)c;
+              c >>= 32;
+            }
+          for(std::size_t k = (i + LIMBS); c && (k <= (LIMBS * 2)); k++)
+            {
+              c += t[k];
+              t[k] = (u32)c;
+              c >>= 32;
+            }
+        }
+
+      // t[LIMBS..] is now x_ * R^-1 mod m; one more multiplication by
+      // R^2 brings it back to x_ mod m.
+      return mul(_finish(t + LIMBS,t[LIMBS * 2]),_r2);
+    }
+
+    // a_ * b_ mod m for a_, b_ below m.
+    Int
+    mod_mul(const Int &a_,
+            const Int &b_) const
+    {
+      return mul(mul(a_,b_),_r2);
+    }
+
+    // a_ - b_ mod m for a_, b_ below m.
+    Int
+    mod_sub(const Int &a_,
+            const Int &b_) const
+    {
+      Int rv = a_;
+
+      if(sub(rv,b_))
+        add(rv,_m);
+
+      return rv;
+    }
+
+    // base_^exponent_ mod m using a fixed 4 bit window.
+    Int
+    exp(const Int &base_,
+        const Int &exponent_) const
+    {
+      Int table[16];
+
+      table[0] = to_mont(one<LIMBS>());
+      table[1] = to_mont(base_);
+      for(int i = 2; i < 16; i++)
+        table[i] = mul(table[i - 1],table[1]);
+
+      Int acc = table[0];
+      for(std::size_t i = (LIMBS * 8); i-- > 0;)
+        {
+          const u32 window = ((exponent_.limbs[i / 8] >> (4 * (i % 8))) & 0xF);
+
+          for(int j = 0; j < 4; j++)
+            acc = mul(acc,acc);
+          acc = mul(acc,table[window]);
+        }
+
+      return from_mont(acc);
+    }
+
+    // base_^exponent_ mod m for a small public exponent.
+    Int
+    exp(const Int &base_,
+        const u32  exponent_) const
+    {
+      const Int x = to_mont(base_);
+      Int acc = to_mont(one<LIMBS>());
+
+      for(int i = 31; i >= 0; i--)
+        {
+          acc = mul(acc,acc);
+          if((exponent_ >> i) & 1)
+            acc = mul(acc,x);
+        }
+
+      return from_mont(acc);
+    }
+
+  private:
+    // Final conditional subtraction of a LIMBS wide value plus carry
+    // which is known to be below 2m.
+    Int
+    _finish(const u32 *t_,
+            const u32  carry_) const
+    {
+      Int rv;
+
+      for(std::size_t i = 0; i < LIMBS; i++)
+        rv.limbs[i] = t_[i];
+      if(carry_ || (compare(rv,_m) >= 0))
+        sub(rv,_m);
+
+      return rv;
+    }
+
+  private:
+    Int _m;
+    Int _r2;
+    u32 _m0inv;
+  };
+}
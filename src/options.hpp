@@ -49,6 +49,8 @@ public:
   {
     PathVec     filepaths;
     std::string format;
+    u32         jobs = 1;
+    bool        tiered = false;
   };
 
   struct Unpack
@@ -57,11 +59,17 @@ public:
     Path        output;
     Path        layout;
     std::string format;
+    u32         jobs = 1;
+    u32         max_memory = 64;
+    bool        disc_order = false;
   };
 
   struct Pack
   {
     Path        input;
+    // Repack sets this to build the filesystem from a source image's
+    // walk and copy file data straight out of it instead of input.
+    Path        input_image;
     Path        summary_input;
     Path        output;
     Path        layout;
@@ -107,6 +115,7 @@ public:
     Path input;
     Path output;
     bool force = false;
+    bool progress = true;
   };
 
   struct ROMTags
@@ -122,6 +131,7 @@ public:
     bool        quiet = false;
     bool        verbose = false;
     bool        internal = false;
+    u32         jobs = 1;
   };
 
   struct Sign
@@ -0,0 +1,137 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace OrderedJobs
+{
+  // How many items per job workers may run ahead of emit_.
+  constexpr u64 LOOKAHEAD = 4;
+
+  // Runs work_(i) for every i in [0,count_) on up to jobs_ threads and
+  // calls emit_(i) on the calling thread in index order, each as soon
+  // as item i and every item before it have finished. Workers never
+  // start an item more than jobs * LOOKAHEAD past the last one
+  // emitted, so finished results waiting on a slow emit_ stay
+  // bounded. work_ must not throw; capture failures in the item's
+  // result instead. If emit_ throws the workers finish their current
+  // item and are joined before the exception propagates. With one job
+  // everything runs inline on the calling thread.
+  template<typename WorkFunc, typename EmitFunc>
+  void
+  run(const u64   count_,
+      const u64   jobs_,
+      WorkFunc  &&work_,
+      EmitFunc  &&emit_)
+  {
+    const u64 jobs = std::min<u64>(std::max<u64>(jobs_,1),count_);
+
+    if(jobs <= 1)
+      {
+        for(u64 i = 0; i < count_; i++)
+          {
+            work_(i);
+            emit_(i);
+          }
+        return;
+      }
+
+    const u64 window = (jobs * LOOKAHEAD);
+    std::mutex mutex;
+    std::condition_variable cv;
+    u64 next = 0;
+    u64 emitted = 0;
+    bool stop = false;
+    std::vector<char> done(count_,false);
+    std::vector<std::thread> workers;
+
+    auto stop_and_join = [&]()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      cv.notify_all();
+
+      for(auto &worker : workers)
+        worker.join();
+    };
+
+    try
+      {
+        for(u64 i = 0; i < jobs; i++)
+          workers.emplace_back([&]()
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            for(;;)
+              {
+                u64 idx;
+
+                cv.wait(lock,[&]()
+                {
+                  return (stop ||
+                          (next >= count_) ||
+                          (next < (emitted + window)));
+                });
+                if(stop || (next >= count_))
+                  return;
+
+                idx = next++;
+                lock.unlock();
+                work_(idx);
+                lock.lock();
+
+                done[idx] = true;
+                cv.notify_all();
+              }
+          });
+
+        for(u64 i = 0; i < count_; i++)
+          {
+            {
+              std::unique_lock<std::mutex> lock(mutex);
+              cv.wait(lock,[&]() { return done[i]; });
+            }
+
+            emit_(i);
+
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              emitted = (i + 1);
+            }
+            cv.notify_all();
+          }
+      }
+    catch(...)
+      {
+        stop_and_join();
+        throw;
+      }
+
+    stop_and_join();
+  }
+}
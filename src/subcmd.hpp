@@ -20,6 +20,11 @@
 
 #include "options.hpp"
 
+namespace TDO
+{
+  class PayloadDigests;
+}
+
 namespace Subcmd
 {
   void version();
@@ -33,6 +38,10 @@ namespace Subcmd
   void to_iso(const Options::ToISO &options);
   void romtags(const Options::ROMTags &options);
   int verify(const Options::Verify &options);
+  // For pack: digests hold the hash state captured while packing and
+  // signing the single image in options.
+  int verify(const Options::Verify &options,
+             TDO::PayloadDigests   *digests);
   void sign(const Options::Sign &options);
   void sign_file(const Options::SignFile &);
   void decrypt_file(const Options::DecFile &);
@@ -23,15 +23,21 @@
 #include "error_unknown_image_format.hpp"
 #include "log.hpp"
 #include "options.hpp"
+#include "ordered_jobs.hpp"
 #include "tdo_dev_stream.hpp"
 #include "tdo_disc_identifier.hpp"
 #include "tdo_disc_ids.hpp"
+#include "tdo_image_fstream.hpp"
 
 #include "fmt.hpp"
 
 #include <algorithm>
-#include <fstream>
+#include <cctype>
+#include <cstdio>
 #include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -44,50 +50,81 @@ struct PrintData
   uint32_t total_data_size;
   TDO::IDVec full_matches;
   TDO::IDVec partial_matches;
+  bool tiered;
+  TDO::IdentifyTier tier;
 };
 
-typedef std::function<void(const PrintData&)> PrintFunc;
+struct IdentifyResult
+{
+  std::string out;
+  std::string err;
+};
+
+typedef std::function<void(std::string&,const PrintData&)> PrintFunc;
 
 namespace
 {
+  static
+  const char*
+  tier_str(const TDO::IdentifyTier tier_)
+  {
+    switch(tier_)
+      {
+      case TDO::IdentifyTier::Label:
+        return "label";
+      case TDO::IdentifyTier::Filesystem:
+        return "filesystem";
+      }
+
+    return "unknown";
+  }
+
   static
   void
-  print_human(const PrintData &data_)
+  print_human(std::string     &out_,
+              const PrintData &data_)
   {
-    fmt::print("{}:\n"
-                " - volume_unique_identifier: 0x{:08X}\n"
-                " - volume_block_count: {}\n"
-                " - root_unique_identifier: 0x{:08X}\n"
-                " - file_count: {}\n"
-                " - total_data_size: {}\n",
-                data_.filename,
-                data_.label.volume_unique_identifier,
-                data_.label.volume_block_count,
-                data_.label.root_unique_identifier,
-                data_.file_count,
-                data_.total_data_size);
+    fmt::format_to(std::back_inserter(out_),
+                   "{}:\n"
+                   " - volume_unique_identifier: 0x{:08X}\n"
+                   " - volume_block_count: {}\n"
+                   " - root_unique_identifier: 0x{:08X}\n",
+                   data_.filename,
+                   data_.label.volume_unique_identifier,
+                   data_.label.volume_block_count,
+                   data_.label.root_unique_identifier);
+    if(data_.tier == TDO::IdentifyTier::Filesystem)
+      fmt::format_to(std::back_inserter(out_),
+                     " - file_count: {}\n"
+                     " - total_data_size: {}\n",
+                     data_.file_count,
+                     data_.total_data_size);
+    if(data_.tiered)
+      fmt::format_to(std::back_inserter(out_),
+                     " - identified_by: {}\n",
+                     tier_str(data_.tier));
 
     if(data_.full_matches.empty() && data_.partial_matches.empty())
       {
-        fmt::print(" - no_matches:\n"
-                   "   - Please file a ticket at\n"
-                   "   - https://github.com/trapexit/3dt/issues\n"
-                   "   - with the details above.\n");
+        out_ += " - no_matches:\n"
+                "   - Please file a ticket at\n"
+                "   - https://github.com/trapexit/3dt/issues\n"
+                "   - with the details above.\n";
         return;
       }
 
     if(!data_.full_matches.empty())
       {
-        fmt::print(" - matches:\n");
+        out_ += " - matches:\n";
         for(auto id : data_.full_matches)
-          fmt::print("   - {}\n",id->name);
+          fmt::format_to(std::back_inserter(out_),"   - {}\n",id->name);
       }
 
     if(!data_.partial_matches.empty())
       {
-        fmt::print(" - partial_matches:\n");
+        out_ += " - partial_matches:\n";
         for(auto id : data_.partial_matches)
-          fmt::print(stdout,"   - {}\n",id->name);
+          fmt::format_to(std::back_inserter(out_),"   - {}\n",id->name);
       }
   }
 
@@ -100,26 +137,38 @@ namespace
     csv_ << fmt::format("0x{:08X}",data_.label.volume_unique_identifier);
     csv_ << data_.label.volume_block_count;
     csv_ << fmt::format("0x{:08X}",data_.label.root_unique_identifier);
-    csv_ << data_.file_count;
-    csv_ << data_.total_data_size;
+    if(data_.tier == TDO::IdentifyTier::Filesystem)
+      {
+        csv_ << data_.file_count;
+        csv_ << data_.total_data_size;
+      }
+    else
+      {
+        csv_ << "";
+        csv_ << "";
+      }
   }
 
   static
   void
-  print_csv_no_matches(const PrintData &data_)
+  print_csv_no_matches(std::string     &out_,
+                       const PrintData &data_)
   {
     CSVWriter csv(",");
 
     print_csv_base(data_,csv);
     csv << "no_match"
         << "file ticket at https://github.com/trapexit/3dt/issues";
+    if(data_.tiered)
+      csv << tier_str(data_.tier);
 
-    fmt::print("{}\n",csv.toString());
+    fmt::format_to(std::back_inserter(out_),"{}\n",csv.toString());
   }
 
   static
   void
-  print_csv_matches(const PrintData &data_)
+  print_csv_matches(std::string     &out_,
+                    const PrintData &data_)
   {
     for(auto id : data_.full_matches)
       {
@@ -128,8 +177,10 @@ namespace
         print_csv_base(data_,csv);
         csv << "full"
             << id->name;
+        if(data_.tiered)
+          csv << tier_str(data_.tier);
 
-        fmt::print("{}\n",csv.toString());
+        fmt::format_to(std::back_inserter(out_),"{}\n",csv.toString());
       }
 
     for(auto id : data_.partial_matches)
@@ -139,30 +190,38 @@ namespace
         print_csv_base(data_,csv);
         csv << "partial"
             << id->name;
+        if(data_.tiered)
+          csv << tier_str(data_.tier);
 
-        fmt::print("{}\n",csv.toString());
+        fmt::format_to(std::back_inserter(out_),"{}\n",csv.toString());
       }
   }
 
   static
   void
-  print_csv(const PrintData &data_)
+  print_csv(std::string     &out_,
+            const PrintData &data_)
   {
     if(data_.full_matches.empty() && data_.partial_matches.empty())
-      return print_csv_no_matches(data_);
-    return print_csv_matches(data_);
+      return print_csv_no_matches(out_,data_);
+    return print_csv_matches(out_,data_);
   }
 
   static
   void
   identify(const PrintFunc &printfunc_,
+           const bool       tiered_,
            const fs::path  &filepath_,
-           std::iostream   &ios_)
+           std::iostream   &ios_,
+           std::string     &out_)
   {
     PrintData data;
     TDO::DiscIdentifier identifier;
 
-    identifier.identify(ios_);
+    if(tiered_)
+      identifier.identify_tiered(ios_);
+    else
+      identifier.identify(ios_);
 
     data.filename        = filepath_;
     data.label           = identifier.label;
@@ -170,27 +229,154 @@ namespace
     data.total_data_size = identifier.fsstats.total_data_size;
     data.full_matches    = identifier.full_matches;
     data.partial_matches = identifier.partial_matches;
+    data.tiered          = tiered_;
+    data.tier            = identifier.tier;
 
-    printfunc_(data);
+    printfunc_(out_,data);
   }
 
+  // Runs on a worker thread: everything destined for stdout or stderr
+  // is collected in the result and written in argument order.
   static
   void
   identify(const PrintFunc &printfunc_,
-           const fs::path  &filepath_)
+           const bool       tiered_,
+           const fs::path  &filepath_,
+           IdentifyResult  &result_)
+  {
+    try
+      {
+        TDO::ImageFStream fs;
+
+        fs.open(filepath_,std::ios::binary|std::ios::in);
+        if(!fs.good())
+          {
+            result_.err = Log::error_stream_open_str(filepath_);
+            throw Error("failed to open");
+          }
+
+        ::identify(printfunc_,tiered_,filepath_,fs,result_.out);
+
+        fs.close();
+      }
+    catch(const std::exception &e)
+      {
+        result_.err += fmt::format("3dt: {} - {}\n",e.what(),filepath_);
+      }
+  }
+
+  // Dump folders keep .cue, .txt, .md5, etc. next to the images so
+  // only files that look like images are taken from a directory walk.
+  // Paths given explicitly are always identified.
+  static
+  bool
+  is_image_path(const fs::path &path_)
+  {
+    std::string ext;
+
+    ext = path_.extension().string();
+    std::transform(ext.begin(),ext.end(),ext.begin(),
+                   [](const unsigned char c_) { return std::tolower(c_); });
+
+    return ((ext == ".iso") ||
+            (ext == ".bin") ||
+            (ext == ".img"));
+  }
+
+  static
+  void
+  expand_path(const fs::path   &path_,
+              Options::PathVec &paths_,
+              bool             &failed_)
   {
-    std::fstream fs;
+    Options::PathVec found;
+    std::error_code ec;
 
-    fs.open(filepath_,std::ios::binary|std::ios::in);
-    if(!fs.good())
+    if(!fs::is_directory(path_,ec))
       {
-        Log::error_stream_open(filepath_);
-        throw Error("failed to open");
+        paths_.emplace_back(path_);
+        return;
+      }
+
+    fs::recursive_directory_iterator iter(path_,
+                                          fs::directory_options::skip_permission_denied,
+                                          ec);
+    if(ec)
+      {
+        fmt::print(stderr,"3dt: {} - {}\n",ec.message(),path_);
+        failed_ = true;
+        return;
       }
 
-    ::identify(printfunc_,filepath_,fs);
+    const fs::recursive_directory_iterator end;
+    while(iter != end)
+      {
+        const fs::directory_entry &entry = *iter;
+
+        if(entry.is_directory(ec))
+          {
+            // Opened here so an unreadable directory is reported and
+            // skipped instead of being dropped silently or ending the
+            // whole walk.
+            fs::directory_iterator dir(entry.path(),ec);
+            if(ec)
+              {
+                fmt::print(stderr,"3dt: {} - {}\n",ec.message(),entry.path());
+                failed_ = true;
+                iter.disable_recursion_pending();
+              }
+          }
+        else if(entry.is_regular_file(ec) && is_image_path(entry.path()))
+          {
+            found.emplace_back(entry.path());
+          }
+
+        iter.increment(ec);
+        if(ec)
+          {
+            fmt::print(stderr,"3dt: {} - {}\n",ec.message(),path_);
+            failed_ = true;
+            break;
+          }
+      }
 
-    fs.close();
+    std::sort(found.begin(),found.end());
+    paths_.insert(paths_.end(),found.begin(),found.end());
+  }
+
+  // Directories expand to every .iso, .bin and .img file below them
+  // in sorted order. "-" reads one path per line from stdin so huge
+  // batches need not fit on the command line; stdin is read to the
+  // end before anything is identified. Directories that can't be read
+  // are reported and set failed_.
+  static
+  Options::PathVec
+  expand_paths(const Options::PathVec &filepaths_,
+               bool                   &failed_)
+  {
+    Options::PathVec paths;
+
+    for(const auto &filepath : filepaths_)
+      {
+        if(filepath == "-")
+          {
+            std::string line;
+
+            while(std::getline(std::cin,line))
+              {
+                if(!line.empty() && (line.back() == '\r'))
+                  line.pop_back();
+                if(line.empty())
+                  continue;
+                expand_path(line,paths,failed_);
+              }
+            continue;
+          }
+
+        expand_path(filepath,paths,failed_);
+      }
+
+    return paths;
   }
 
   static
@@ -212,23 +398,35 @@ namespace Subcmd
   identify(const Options::Identify &options_)
   {
     bool failed;
+    Options::PathVec filepaths;
     PrintFunc printfunc;
+    std::vector<IdentifyResult> results;
 
-    printfunc = get_print_func(options_.format);
     failed = false;
-
-    for(auto &filepath : options_.filepaths)
-      {
-        try
-          {
-            ::identify(printfunc,filepath);
-          }
-        catch(const std::exception &e)
-          {
-            fmt::print(stderr,"3dt: {} - {}\n",e.what(),filepath);
-            failed = true;
-          }
-      }
+    printfunc = get_print_func(options_.format);
+    filepaths = expand_paths(options_.filepaths,failed);
+    results.resize(filepaths.size());
+
+    OrderedJobs::run(filepaths.size(),
+                     options_.jobs,
+                     [&](const u64 i_)
+                     {
+                       ::identify(printfunc,options_.tiered,filepaths[i_],results[i_]);
+                     },
+                     [&](const u64 i_)
+                     {
+                       IdentifyResult &result = results[i_];
+
+                       if(!result.out.empty())
+                         fmt::print("{}",result.out);
+                       if(!result.err.empty())
+                         {
+                           fmt::print(stderr,"{}",result.err);
+                           failed = true;
+                         }
+                       std::fflush(stdout);
+                       result = IdentifyResult();
+                     });
 
     if(failed)
       throw Error("identify failed");
@@ -19,12 +19,11 @@
 #include "log.hpp"
 #include "options.hpp"
 #include "tdo_fs_walker.hpp"
+#include "tdo_image_fstream.hpp"
 #include "tdo_safe_narrow.hpp"
 
 #include "fmt.hpp"
 
-#include <fstream>
-
 namespace fs = std::filesystem;
 typedef std::function<void(const std::string&,const TDO::DirectoryRecord&,const uint32_t,TDO::DevStream&)> Printer;
 
@@ -324,7 +323,7 @@ namespace Subcmd
   void
   list(const Options::List &opts_)
   {
-    std::fstream fs;
+    TDO::ImageFStream fs;
     ListCallbacks callbacks(opts_);
     TDO::FSWalker walker(fs,callbacks);
 
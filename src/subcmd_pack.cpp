@@ -29,6 +29,7 @@
 #include "tdo_disc_signer.hpp"
 #include "tdo_file_stream.hpp"
 #include "tdo_fs_walker.hpp"
+#include "tdo_payload_digests.hpp"
 #include "tdo_rsa.hpp"
 #include "tdo_safe_narrow.hpp"
 #include "crc32b_file.hpp"
@@ -405,18 +406,28 @@ namespace
       }
   }
 
+  // Builds the entry for one source file or directory. The directory
+  // reader and the image reader both go through here so they always
+  // describe the same source the same way. path_ gives the name and
+  // type; src_path_ is where the data is read from.
   static
   std::unique_ptr<Entry>
-  make_entry(const fs::directory_entry &dirent_)
+  make_source_entry(const fs::path &src_path_,
+                    const bool      src_is_image_,
+                    const fs::path &path_,
+                    const bool      directory_,
+                    const u32       byte_count_)
   {
     auto entry = std::make_unique<Entry>();
 
-    entry->src_path           = dirent_.path();
-    entry->name               = dirent_.path().filename().string();
+    entry->src_path           = src_path_;
+    entry->src_is_image       = src_is_image_;
+    entry->src_image_pos      = 0;
+    entry->name               = path_.filename().string();
     entry->kind               = EntryKind::Normal;
-    entry->directory          = dirent_.is_directory();
+    entry->directory          = directory_;
     entry->unique_identifier  = 0;
-    entry->type               = (entry->directory ? DR_TYPE_DIRECTORY : file_type(dirent_.path()));
+    entry->type               = (entry->directory ? DR_TYPE_DIRECTORY : file_type(path_));
     entry->flags              = DR_FLAG_IS_READONLY;
     entry->block_size         = TDO::BLOCK_SIZE;
     entry->byte_count         = 0;
@@ -435,6 +446,26 @@ namespace
         entry->flags |= (DR_FLAG_IS_DIRECTORY | DR_FLAG_IS_FOR_FILESYSTEM);
       }
     else
+      {
+        entry->byte_count      = byte_count_;
+        entry->data_byte_count = entry->byte_count;
+        entry->block_count     = block_count_for_size(entry->byte_count);
+        if(lowercase(entry->name) == "launchme")
+          entry->type = DR_TYPE_CATAPULT;
+      }
+
+    return entry;
+  }
+
+  static
+  std::unique_ptr<Entry>
+  make_entry(const fs::directory_entry &dirent_)
+  {
+    u32 byte_count;
+    const bool directory = dirent_.is_directory();
+
+    byte_count = 0;
+    if(!directory)
       {
         u64 size;
         std::error_code ec;
@@ -443,14 +474,10 @@ namespace
         if(ec)
           throw Error("failed to stat input file: " +
                       dirent_.path().string() + ": " + ec.message());
-        entry->byte_count      = TDO::checked_narrow_u64_to_u32(size,"file size");
-        entry->data_byte_count = entry->byte_count;
-        entry->block_count     = block_count_for_size(size);
-        if(lowercase(entry->name) == "launchme")
-          entry->type = DR_TYPE_CATAPULT;
+        byte_count = TDO::checked_narrow_u64_to_u32(size,"file size");
       }
 
-    return entry;
+    return make_source_entry(dirent_.path(),false,dirent_.path(),directory,byte_count);
   }
 
   static
@@ -494,6 +521,128 @@ namespace
       }
   }
 
+  // Builds the same tree read_directory() would from the image
+  // unpacked with DiscUnpacker, but with every file's data left in
+  // the image: entries point at the data bytes of the first avatar.
+  class ImageDirectoryReader final : public TDO::FSWalker::Callbacks
+  {
+  public:
+    ImageDirectoryReader(const fs::path &image_,
+                         Entry          &root_)
+      : _image(image_)
+    {
+      _dirs[fs::path()] = &root_;
+    }
+
+  public:
+    void
+    operator()(const fs::path             &path_,
+               const TDO::DirectoryRecord &record_,
+               const uint32_t,
+               TDO::DevStream             &stream_)
+    {
+      Entry *parent;
+      std::unique_ptr<Entry> entry;
+      const bool root = path_.parent_path().empty();
+
+      parent = _dirs.at(path_.parent_path());
+
+      // Unpack writes these at the root but read_directory() skips them.
+      if(root && !record_.is_directory() && is_unpacked_metadata_file(path_))
+        return;
+
+      if(!record_.is_directory() &&
+         (record_.byte_count > 0) &&
+         record_.avatar_list.empty())
+        throw Error("file record has byte_count > 0 but no avatars: " +
+                    path_.string());
+
+      entry = make_source_entry(_image,
+                                true,
+                                path_,
+                                record_.is_directory(),
+                                record_.byte_count);
+      if(!entry->directory && (entry->byte_count > 0))
+        entry->src_image_pos = (static_cast<u64>(record_.avatar_list[0]) *
+                                stream_.device_block_data_size());
+
+      // Unpacking a record whose name is already taken overwrites a
+      // file or reuses a directory; anything else fails there too.
+      for(auto &child : parent->children)
+        {
+          if(child->name != entry->name)
+            continue;
+          if(child->directory != entry->directory)
+            throw Error("conflicting entries in source image: " + path_.string());
+          if(entry->directory)
+            {
+              _dirs[path_] = child.get();
+              return;
+            }
+          child = std::move(entry);
+          return;
+        }
+
+      if(entry->directory)
+        _dirs[path_] = entry.get();
+      parent->children.emplace_back(std::move(entry));
+    }
+
+    Error
+    invalid_filename(const fs::path             &parent_,
+                     const std::string          &filename_,
+                     const TDO::DirectoryRecord&,
+                     const uint32_t,
+                     const Error                &err_,
+                     TDO::DevStream&)
+    {
+      fmt::print(stderr,"3dt: {} - {}\n",
+                 err_.str,
+                 fs::path(TDO::display_path(parent_,filename_)).generic_string());
+
+      return Error();
+    }
+
+  public:
+    static
+    void
+    sort(Entry &entry_)
+    {
+      std::sort(entry_.children.begin(),
+                entry_.children.end(),
+                [](const std::unique_ptr<Entry> &lhs_,
+                   const std::unique_ptr<Entry> &rhs_)
+                {
+                  return (fs::path(lhs_->name) < fs::path(rhs_->name));
+                });
+
+      for(auto &child : entry_.children)
+        if(child->directory)
+          sort(*child);
+    }
+
+  private:
+    const fs::path                          &_image;
+    std::unordered_map<fs::path,Entry*,
+                       std::hash<fs::path>> _dirs;
+  };
+
+  static
+  void
+  read_image_directory(const fs::path &image_,
+                       Entry          &root_)
+  {
+    TDO::FileStream stream;
+    ImageDirectoryReader reader(image_,root_);
+
+    stream.open(image_);
+
+    TDO::FSWalker fsw(stream,reader);
+    fsw.walk();
+
+    ImageDirectoryReader::sort(root_);
+  }
+
   static
   Entry*
   find_root_child(Entry       &root_,
@@ -515,6 +664,8 @@ namespace
   {
     auto entry = std::make_unique<Entry>();
 
+    entry->src_is_image       = false;
+    entry->src_image_pos      = 0;
     entry->name               = name_;
     entry->kind               = EntryKind::Normal;
     entry->directory          = false;
@@ -1141,6 +1292,15 @@ namespace
 
     if(data.empty())
       throw Error("signed payload is empty: " + display_path(entry_path_));
+    if(entry_.src_is_image)
+      {
+        TDO::FileStream stream;
+
+        stream.open(entry_.src_path);
+        stream.pread_data_bytes(data.data(),entry_.src_image_pos,data.size());
+
+        return data;
+      }
     is.open(entry_.src_path,std::ios::binary);
     if(!is)
       throw Error("failed to open signed payload: " + entry_.src_path.string());
@@ -1635,7 +1795,9 @@ namespace
   void
   preflight_input_files(const Entry &entry_)
   {
-    if(!entry_.directory && (entry_.kind == EntryKind::Normal))
+    if(!entry_.directory &&
+       (entry_.kind == EntryKind::Normal) &&
+       !entry_.src_is_image)
       {
         std::ifstream is;
 
@@ -1746,8 +1908,16 @@ namespace
     fs::path layout_path;
     u32 next_id;
 
-    validate_output_location(options_.input,options_.output);
-    reject_symlink_path(options_.input);
+    if(!options_.input_image.empty())
+      {
+        if(!options_.layout.empty())
+          throw Error("layout replay requires an unpacked input directory");
+      }
+    else
+      {
+        validate_output_location(options_.input,options_.output);
+        reject_symlink_path(options_.input);
+      }
 
     manifest.output = options_.output;
     manifest.disc_label = {};
@@ -1770,6 +1940,8 @@ namespace
     manifest.disc_label.root_directory_block_size = TDO::BLOCK_SIZE;
     manifest.total_blocks = 0;
     manifest.replay_layout = false;
+    manifest.root.src_is_image = false;
+    manifest.root.src_image_pos = 0;
     manifest.root.name = "";
     manifest.root.kind = EntryKind::Normal;
     manifest.root.directory = true;
@@ -1791,7 +1963,10 @@ namespace
     if(!layout_path.empty())
       layout = read_layout(layout_path,manifest);
 
-    read_directory(options_.input,manifest.root);
+    if(!options_.input_image.empty())
+      read_image_directory(options_.input_image,manifest.root);
+    else
+      read_directory(options_.input,manifest.root);
     add_or_replace_synthetic_entries(manifest.root,true);
 
     next_id = 2;
@@ -1860,6 +2035,41 @@ namespace
       }
   }
 
+  // The payloads the signer hashes are hashed by the packer as it
+  // writes them. The whole allocation is tracked since a signed extent
+  // may run past the source file into the zero fill.
+  static
+  void
+  track_signed_payloads(const TDO::DiscManifestEntry &dir_,
+                        const fs::path               &dir_path_,
+                        const bool                    include_banner_,
+                        TDO::PayloadDigests          &digests_)
+  {
+    for(const auto &child : dir_.children)
+      {
+        const fs::path path = dir_path_ / child->name;
+
+        if(child->kind != EntryKind::Normal)
+          continue;
+        if(child->directory)
+          {
+            track_signed_payloads(*child,path,include_banner_,digests_);
+            continue;
+          }
+        if(signed_romtag_type_for_path(path,include_banner_) == 0)
+          continue;
+        if(child->block_count == 0)
+          continue;
+
+        const u32 block = (child->avatar_list.empty() ?
+                           child->start_block :
+                           child->avatar_list[0]);
+
+        digests_.track(static_cast<u64>(block) * TDO::BLOCK_SIZE,
+                       static_cast<u64>(child->block_count) * TDO::BLOCK_SIZE);
+      }
+  }
+
   static
   void
   print_pack_summary(const Options::Pack &options_,
@@ -1938,10 +2148,21 @@ namespace Subcmd
 
     try
       {
-        TDO::pack_disc_image(manifest);
-
+        TDO::PayloadDigests digests;
         const bool recreate_layout_specials = (manifest.replay_layout &&
                                                options_.sign);
+        // Plain signing hashes os_code, misc_code, boot_code and
+        // BannerScreen from the state the packer captured and verify
+        // reuses it. Every write to the image in between goes through
+        // a stream that reports it, except marking which only touches
+        // the disc label.
+        const bool hash_on_write = (options_.sign && !recreate_layout_specials);
+
+        if(hash_on_write)
+          track_signed_payloads(manifest.root,{},options_.banner_romtag,digests);
+
+        TDO::pack_disc_image(manifest,(hash_on_write ? &digests : nullptr));
+
         if(options_.mark)
           {
             TDO::mark_disc_image(temp_output_path,
@@ -1983,7 +2204,8 @@ namespace Subcmd
                                  options_.banner_romtag,
                                  options_.billstuff_romtag,
                                  manifest.source_romtags,
-                                 options_.verbose);
+                                 options_.verbose,
+                                 &digests);
           }
 
         if(options_.sign)
@@ -1997,7 +2219,8 @@ namespace Subcmd
             if(options_.verbose)
               fmt::print("{}:\n  - Verifying signed image\n",temp_output_path);
 
-            const int code = Subcmd::verify(verify_opts);
+            const int code = Subcmd::verify(verify_opts,
+                                            (hash_on_write ? &digests : nullptr));
             if(code != 0)
               throw Error("verification failed",code);
           }
@@ -63,9 +63,8 @@ namespace
     temp_path = temp_path_for(target_);
     try
       {
-        fs::copy_file(input_,temp_path,fs::copy_options::none);
-
-        TDO::sign_disc_image(temp_path,
+        TDO::sign_disc_image(input_,
+                             temp_path,
                              opts_.mark,
                              !opts_.force,
                              opts_.banner_romtag,
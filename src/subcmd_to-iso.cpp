@@ -23,12 +23,20 @@
 
 #include "fmt.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <filesystem>
 #include <system_error>
+#include <vector>
 
 namespace fs = std::filesystem;
 
+static constexpr std::uint64_t ISO_BLOCK_SIZE = 2048;
+// 512 blocks is 1MiB of output per read and write.
+static constexpr std::uint64_t CHUNK_BLOCKS = 512;
+static constexpr auto PROGRESS_INTERVAL = std::chrono::milliseconds(250);
+
 static
 fs::path
 get_output_path(const Options::ToISO &options_)
@@ -73,6 +81,44 @@ existing_paths_equivalent(const fs::path &lhs_,
   return equivalent;
 }
 
+// Reads `count_` ISO blocks starting at block `block_` into `out_`.
+// When the 2048 byte data blocks line up with ISO blocks DevStream
+// gathers the whole chunk, stripping any sector headers and footers.
+static
+void
+read_chunk(TDO::FileStream     &stream_,
+           const std::uint64_t  block_,
+           const std::uint64_t  count_,
+           char                *out_)
+{
+  const std::uint64_t data_size = stream_.device_block_data_size();
+
+  if(data_size != ISO_BLOCK_SIZE)
+    {
+      for(std::uint64_t i = 0; i < count_; i++)
+        {
+          stream_.data_byte_seek((block_ + i) * data_size);
+          stream_.read(&out_[i * ISO_BLOCK_SIZE],ISO_BLOCK_SIZE);
+        }
+      return;
+    }
+
+  stream_.read_data_bytes(out_,block_ * data_size,count_ * data_size);
+}
+
+static
+void
+print_progress(const fs::path      &output_path_,
+               const std::uint64_t  block_,
+               const std::uint64_t  blocks_)
+{
+  fmt::print("\r{}: block {} of {} written",
+             output_path_,
+             block_,
+             (blocks_ == 0 ? 0 : (blocks_ - 1)));
+  std::fflush(stdout);
+}
+
 namespace Subcmd
 {
   void
@@ -82,7 +128,8 @@ namespace Subcmd
     std::ofstream ofs;
     fs::path output_path;
     TDO::FileStream stream;
-    std::array<char,2048> buf;
+    std::vector<char> buf;
+    std::chrono::steady_clock::time_point last_progress;
 
     output_path = get_output_path(options_);
     if((output_path == options_.input) ||
@@ -123,22 +170,29 @@ namespace Subcmd
       blocks = 0;
     try
       {
-        for(std::uint64_t block = 0; block < blocks; block++)
+        buf.resize(std::min(blocks,CHUNK_BLOCKS) * ISO_BLOCK_SIZE);
+        for(std::uint64_t block = 0; block < blocks;)
           {
-            stream.data_byte_seek(block * stream.device_block_data_size());
-            stream.read(buf);
+            const std::uint64_t count = std::min(blocks - block,CHUNK_BLOCKS);
+            const std::uint64_t bytes = count * ISO_BLOCK_SIZE;
+
+            read_chunk(stream,block,count,buf.data());
 
-            ofs.write(buf.data(),buf.size());
+            ofs.write(buf.data(),bytes);
             if(ofs.bad())
               {
                 Log::error({"write failed"});
                 throw Error("to-iso failed");
               }
 
-            fmt::print("\r{}: block {} of {} written",
-                       output_path,
-                       block,
-                       (blocks == 0 ? 0 : (blocks - 1)));
+            block += count;
+            if(options_.progress &&
+               ((block == blocks) ||
+                ((std::chrono::steady_clock::now() - last_progress) >= PROGRESS_INTERVAL)))
+              {
+                print_progress(output_path,block - 1,blocks);
+                last_progress = std::chrono::steady_clock::now();
+              }
           }
       }
     catch(const Error &err)
@@ -147,6 +201,7 @@ namespace Subcmd
         throw Error("to-iso failed");
       }
 
-    fmt::print("\n");
+    if(options_.progress)
+      fmt::print("\n");
   }
 }
@@ -21,6 +21,7 @@
 #include "log.hpp"
 #include "options.hpp"
 #include "tdo_disc_unpacker.hpp"
+#include "tdo_image_fstream.hpp"
 
 #include "CSVWriter.h"
 
@@ -493,7 +494,7 @@ namespace Subcmd
         TDO::DiscUnpacker::Ptr unpacker;
         TDO::DiscUnpacker::Callback::Ptr printer;
         LayoutWriter *layout_writer;
-        std::fstream fs;
+        TDO::ImageFStream fs;
 
         fs.open(srcpath,fs.binary|fs.in);
         if(!fs.is_open())
@@ -519,6 +520,10 @@ namespace Subcmd
           printer = std::move(lw);
         }
         unpacker = std::make_unique<TDO::DiscUnpacker>(fs,*printer);
+        unpacker->set_jobs(options_.jobs,
+                           static_cast<u64>(options_.max_memory) * 1024 * 1024);
+        unpacker->set_disc_order(options_.disc_order,
+                                 static_cast<u64>(options_.max_memory) * 1024 * 1024);
 
         try
           {
@@ -19,7 +19,9 @@
 #include "md5.h"
 #include "subcmd.hpp"
 
+#include "log.hpp"
 #include "options.hpp"
+#include "ordered_jobs.hpp"
 #include "tdo_dev_stream.hpp"
 #include "tdo_disc_format.hpp"
 #include "tdo_disc_label.hpp"
@@ -28,6 +30,7 @@
 #include "tdo_boot_code_crypto.hpp"
 #include "tdo_file_stream.hpp"
 #include "tdo_fs_walker.hpp"
+#include "tdo_payload_digests.hpp"
 #include "tdo_rsa.hpp"
 
 #include "discdata.h"
@@ -40,7 +43,9 @@
 
 #include "types_ints.h"
 
+#include <algorithm>
 #include <array>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <optional>
@@ -52,7 +57,19 @@ static constexpr int VERIFY_EXIT_UNSIGNED = 2;
 static constexpr int VERIFY_EXIT_UNSUPPORTED = 3;
 static constexpr int VERIFY_EXIT_INVALID = 4;
 
-static bool g_quiet = false;
+// Verification output is per image. With --jobs > 1 each image's log,
+// including warnings raised by the lower modules, is buffered and
+// written in command line order once the image finishes so concurrent
+// verifications never interleave.
+struct VerifyLog
+{
+  bool        quiet;
+  bool        buffered;
+  std::string out;
+  std::string err;
+};
+
+static thread_local VerifyLog *t_log = nullptr;
 
 enum class VerifyStatus
   {
@@ -113,10 +130,27 @@ void
 _vprint(const char *fmt_,
         Args&&...   args_)
 {
-  if(!g_quiet)
+  if(t_log->quiet)
+    return;
+
+  if(t_log->buffered)
+    t_log->out += fmt::format(fmt_,std::forward<Args>(args_)...);
+  else
     fmt::print(fmt_,std::forward<Args>(args_)...);
 }
 
+template<typename... Args>
+static
+void
+_veprint(const char *fmt_,
+         Args&&...   args_)
+{
+  if(t_log->buffered)
+    t_log->err += fmt::format(fmt_,std::forward<Args>(args_)...);
+  else
+    fmt::print(stderr,fmt_,std::forward<Args>(args_)...);
+}
+
 static
 bool
 _range_in_image(TDO::DevStream &s_,
@@ -149,10 +183,9 @@ public:
                    const Error                 &err_,
                    TDO::DevStream&)
   {
-    fmt::print(stderr,
-               "3dt: warning: {} - {}\n",
-               err_.str,
-               TDO::display_path(parent_,filename_));
+    _veprint("3dt: warning: {} - {}\n",
+             err_.str,
+             TDO::display_path(parent_,filename_));
 
     return {};
   }
@@ -191,10 +224,9 @@ public:
                    const Error                 &err_,
                    TDO::DevStream&)
   {
-    fmt::print(stderr,
-               "3dt: warning: {} - {}\n",
-               err_.str,
-               TDO::display_path(parent_,filename_));
+    _veprint("3dt: warning: {} - {}\n",
+             err_.str,
+             TDO::display_path(parent_,filename_));
 
     return {};
   }
@@ -228,9 +260,8 @@ private:
 
 static
 bool
-_read_metadata_record_data(TDO::DevStream             &s_,
-                           const ROMTagMetadataRecord &metadata_,
-                           std::vector<char>          &data_)
+_metadata_record_in_image(TDO::DevStream             &s_,
+                          const ROMTagMetadataRecord &metadata_)
 {
   const TDO::DirectoryRecord &record = metadata_.record;
 
@@ -247,10 +278,6 @@ _read_metadata_record_data(TDO::DevStream             &s_,
       return false;
     }
 
-  s_.read_data_bytes_from_block(data_,
-                                record.avatar_list[0],
-                                record.byte_count);
-
   return true;
 }
 
@@ -260,8 +287,8 @@ _verify_romtag_version_revision_fallback(TDO::DevStream                   &s_,
                                          const std::optional<TDO::ROMTag> &romtag_,
                                          const ROMTagMetadataRecord       &metadata_)
 {
+  md5_digest_t digest;
   const TDO::ROMTagVersionRevisionFallback *fallback;
-  std::vector<char> data;
 
   if(metadata_.found && metadata_.record.byte_count == 0)
     {
@@ -271,10 +298,17 @@ _verify_romtag_version_revision_fallback(TDO::DevStream                   &s_,
     }
   if(!romtag_ || !metadata_.found)
     return true;
-  if(!_read_metadata_record_data(s_,metadata_,data))
+  if(!_metadata_record_in_image(s_,metadata_))
     return false;
+  if(!TDO::has_romtag_version_revision_fallback(romtag_->type))
+    return true;
 
-  fallback = TDO::find_romtag_version_revision_fallback(romtag_->type,data);
+  TDO::md5_data_bytes(s_,
+                      metadata_.record.avatar_list[0] * s_.device_block_data_size(),
+                      metadata_.record.byte_count,
+                      digest);
+  fallback = TDO::find_romtag_version_revision_fallback(romtag_->type,
+                                                        digest);
   if(fallback == nullptr)
     return true;
   if((romtag_->version == fallback->version) &&
@@ -414,11 +448,12 @@ _get_cross_app_sig(TDO::DevStream &s_,
 
 static
 void
-_get_sig_from_end(std::vector<char> &data_,
-                  rsa512_sig_t       sig_)
+_get_sig_from_end(const char   *data_,
+                  const u64     size_,
+                  rsa512_sig_t  sig_)
 {
   std::memcpy(sig_,
-              &data_[data_.size() - sizeof(rsa512_sig_t)],
+              &data_[size_ - sizeof(rsa512_sig_t)],
               sizeof(rsa512_sig_t));
 }
 
@@ -469,6 +504,26 @@ _sig_status(const rsa512_sig_t sig_,
   return "invalid";
 }
 
+// Signatures are checked with the public exponent. Signing with the
+// private key is only needed to show the expected signature in verbose
+// output.
+static
+bool
+_check_sig(const char         *key_,
+           const md5_digest_t  digest_,
+           const rsa512_sig_t  original_sig_)
+{
+  if(!t_log->quiet)
+    {
+      rsa512_sig_t computed_sig;
+
+      tdo_rsa_sign(key_,digest_,computed_sig);
+      _vprint("   - computed sig: {}\n",computed_sig);
+    }
+
+  return tdo_rsa_verify_retail(key_,digest_,original_sig_);
+}
+
 
 // See details in `portfolio_os/src/dipir/cdipir.c:1178` from the original Portfolio OS tree.
 static
@@ -477,20 +532,20 @@ _verify_disclabel_romtags_bootcode(TDO::DevStream &s_,
                                    bool           &saw_unsigned_,
                                    bool           &saw_invalid_)
 {
+  md5_ctx_t ctx;
   md5_digest_t digest;
   rsa512_sig_t original_sig;
-  rsa512_sig_t computed_sig;
-  std::vector<char> data;
+  TDO::DataView disc_label;
+  TDO::DataView romtags;
+  TDO::DataView boot_code;
   std::optional<TDO::ROMTag> romtag;
 
   _vprint(" - Verifying DiscLabel + ROMTags + BootCode with APP Key\n");
 
-  s_.read_data_bytes_from_block(data,
-                                s_.disc_label_block(),
-                                s_.disc_label_size_in_bytes());
-  s_.read_data_bytes_from_block(data,
-                                s_.romtags_block(),
-                                s_.romtags_size_in_bytes());
+  disc_label = s_.data_bytes_view_from_block(s_.disc_label_block(),
+                                             s_.disc_label_size_in_bytes());
+  romtags = s_.data_bytes_view_from_block(s_.romtags_block(),
+                                          s_.romtags_size_in_bytes());
 
   romtag = s_.romtag(RSA_NEWKNEWNEWGNUBOOT);
   if(!romtag)
@@ -505,9 +560,8 @@ _verify_disclabel_romtags_bootcode(TDO::DevStream &s_,
       return false;
     }
 
-  s_.read_data_bytes_from_block(data,
-                                newgnuboot_first_block,
-                                romtag->size);
+  boot_code = s_.data_bytes_view_from_block(newgnuboot_first_block,
+                                            romtag->size);
 
   _vprint("   - disc label block: {}\n"
           "   - disc label size: {}b\n"
@@ -525,14 +579,13 @@ _verify_disclabel_romtags_bootcode(TDO::DevStream &s_,
   ::_get_cross_app_sig(s_,original_sig);
   _vprint("   - original sig: {}\n",original_sig);
 
-  md5_calc(data.data(),
-           data.size(),
-           digest);
-
-  tdo_rsa_sign(TDO_KEY_APP,digest,computed_sig);
-  _vprint("   - computed sig: {}\n",computed_sig);
+  md5_init(&ctx);
+  md5_update(&ctx,disc_label.data(),disc_label.size());
+  md5_update(&ctx,romtags.data(),romtags.size());
+  md5_update(&ctx,boot_code.data(),boot_code.size());
+  md5_finalize(&ctx,digest);
 
-  const bool matched = (memcmp(original_sig,computed_sig,sizeof(rsa512_sig_t)) == 0);
+  const bool matched = _check_sig(TDO_KEY_APP,digest,original_sig);
   _vprint("   - match: {}\n",matched);
   _vprint("   - status: {}\n",_sig_status(original_sig,matched,saw_unsigned_,saw_invalid_));
 
@@ -550,8 +603,7 @@ _verify_file(TDO::DevStream &s_,
 {
   md5_digest_t digest;
   rsa512_sig_t original_sig;
-  rsa512_sig_t computed_sig;
-  std::vector<char> data;
+  TDO::DataView sig;
 
   _vprint("   - start block: {}\n"
           "   - file size: {}b\n",
@@ -567,26 +619,22 @@ _verify_file(TDO::DevStream &s_,
       _vprint("   - error: file is outside image bounds\n");
       return false;
     }
-  s_.read_data_bytes_from_block(data,
-                                start_offset_in_blocks_,
-                                size_in_bytes_);
+  const u64 start_pos = (start_offset_in_blocks_ * s_.device_block_data_size());
+
+  sig = s_.data_bytes_view(start_pos + size_in_bytes_ - RSA512_SIG_SIZE,
+                           RSA512_SIG_SIZE);
 
-  _get_sig_from_end(data,original_sig);
+  _get_sig_from_end(sig.data(),sig.size(),original_sig);
   _vprint("   - original sig: {}\n",original_sig);
 
   // CD-ROM ROMTag payload signatures are raw-byte digests up to the
   // trailing signature (cdromdipir.c:ReadOsComponent). Do not apply
   // RSACheck's _3DO_SignatureLen zeroing here.
-  md5_calc(data.data(),
-           data.size() - RSA512_SIG_SIZE,
-           digest);
-  tdo_rsa_sign(key_,
-               digest,
-               computed_sig);
-
-  _vprint("   - computed sig: {}\n",computed_sig);
-
-  const bool matched = (memcmp(original_sig,computed_sig,sizeof(rsa512_sig_t)) == 0);
+  TDO::md5_data_bytes(s_,
+                      start_pos,
+                      size_in_bytes_ - RSA512_SIG_SIZE,
+                      digest);
+  const bool matched = _check_sig(key_,digest,original_sig);
   _vprint("   - match: {}\n",matched);
   _vprint("   - status: {}\n",_sig_status(original_sig,matched,saw_unsigned_,saw_invalid_));
 
@@ -602,7 +650,6 @@ _verify_boot_code_post_cheeze(TDO::DevStream    &s_,
 {
   md5_digest_t digest;
   rsa512_sig_t original_sig;
-  rsa512_sig_t computed_sig;
   std::vector<char> data;
   const u64 start_offset_in_blocks = TDO::safe_romtag_first_data_block(s_,rom_tag_,"boot_code");
   const u64 size_in_bytes = rom_tag_.size;
@@ -627,19 +674,13 @@ _verify_boot_code_post_cheeze(TDO::DevStream    &s_,
   _vprint("   - decrypted data size: {}b\n",
           data.size() - RSA512_SIG_SIZE);
 
-  _get_sig_from_end(data,original_sig);
+  _get_sig_from_end(data.data(),data.size(),original_sig);
   _vprint("   - original sig: {}\n",original_sig);
 
   md5_calc(data.data(),
            data.size() - RSA512_SIG_SIZE,
            digest);
-  tdo_rsa_sign(TDO_KEY_3DO,
-               digest,
-               computed_sig);
-
-  _vprint("   - computed sig: {}\n",computed_sig);
-
-  const bool matched = (memcmp(original_sig,computed_sig,sizeof(rsa512_sig_t)) == 0);
+  const bool matched = _check_sig(TDO_KEY_3DO,digest,original_sig);
   _vprint("   - match: {}\n",matched);
   _vprint("   - status: {}\n",_sig_status(original_sig,matched,saw_unsigned_,saw_invalid_));
 
@@ -831,7 +872,8 @@ _verify_rsa_sigs(TDO::DevStream &s_)
 
 static
 int
-_verify(const Options::Verify &opts_);
+_verify(const Options::Verify &opts_,
+        TDO::PayloadDigests   *digests_);
 
 static
 void
@@ -875,96 +917,156 @@ _print_summary(const std::string                              &format_,
 int
 Subcmd::verify(const Options::Verify &opts_)
 {
-  return ::_verify(opts_);
+  return ::_verify(opts_,nullptr);
 }
 
-static
 int
-_verify(const Options::Verify &opts_)
+Subcmd::verify(const Options::Verify &opts_,
+               TDO::PayloadDigests   *digests_)
 {
-  bool failed;
-  int exit_code;
-  std::string format;
-  std::vector<VerifyResult> results;
+  return ::_verify(opts_,digests_);
+}
 
-  format = opts_.format.empty() ? "human" : opts_.format;
+static
+VerifyResult
+_verify_image(const std::filesystem::path &filepath_,
+              const Options::Verify       &opts_,
+              TDO::PayloadDigests         *digests_,
+              const std::string           &format_,
+              VerifyLog                   &log_)
+{
+  VerifyStatus status;
+  std::string reason;
+  TDO::FileStream stream;
+  Log::CaptureWarnings capture(log_.buffered ? &log_.err : nullptr);
 
-  g_quiet = (opts_.quiet || !opts_.verbose || (format != "human"));
-  failed = false;
-  exit_code = 0;
-  for(const auto &filepath : opts_.filepaths)
+  t_log = &log_;
+
+  status = VerifyStatus::Valid;
+  try
     {
-      bool file_failed;
-      VerifyStatus status;
-      std::string reason;
-      TDO::FileStream stream;
+      stream.open(filepath_);
+      stream.set_payload_digests(digests_);
 
-      file_failed = false;
-      status = VerifyStatus::Valid;
-      try
+      if(!stream.has_romtags())
         {
-          stream.open(filepath);
-
-          if(!stream.has_romtags())
-            {
-              status = VerifyStatus::Unsupported;
-              reason = "image does not contain ROMTags";
-              file_failed = true;
-              throw Error(reason);
-            }
+          status = VerifyStatus::Unsupported;
+          reason = "image does not contain ROMTags";
+          throw Error(reason);
+        }
 
-          _vprint("{}:\n",filepath);
-          ::_verify_operafs_structure(stream);
-          status = ::_verify_rsa_sigs(stream);
-          if(status != VerifyStatus::Valid)
+      _vprint("{}:\n",filepath_);
+      ::_verify_operafs_structure(stream);
+      status = ::_verify_rsa_sigs(stream);
+      if(status != VerifyStatus::Valid)
+        {
+          switch(status)
             {
-              if(reason.empty())
-                {
-                  switch(status)
-                    {
-                    case VerifyStatus::Invalid:
-                      reason = "signature verification failed";
-                      break;
-                    case VerifyStatus::Unsigned:
-                      reason = "image is unsigned";
-                      break;
-                    case VerifyStatus::Unsupported:
-                      reason = "unsupported image";
-                      break;
-                    default:
-                      break;
-                    }
-                }
-              file_failed = true;
+            case VerifyStatus::Invalid:
+              reason = "signature verification failed";
+              break;
+            case VerifyStatus::Unsigned:
+              reason = "image is unsigned";
+              break;
+            case VerifyStatus::Unsupported:
+              reason = "unsupported image";
+              break;
+            default:
+              break;
             }
         }
-      catch(const std::exception &e)
-        {
-          if(reason.empty())
-            reason = e.what();
+    }
+  catch(const std::exception &e)
+    {
+      if(reason.empty())
+        reason = e.what();
 
-          if(status == VerifyStatus::Valid)
-            status = VerifyStatus::Invalid;
+      if(status == VerifyStatus::Valid)
+        status = VerifyStatus::Invalid;
 
-          if(opts_.verbose && (format == "human"))
-            fmt::print(stderr,"3dt: {} - {}\n",reason,filepath);
+      if(opts_.verbose && (format_ == "human"))
+        _veprint("3dt: {} - {}\n",reason,filepath_);
+    }
 
-          file_failed = true;
-        }
+  t_log = nullptr;
 
-      if(file_failed)
-        {
-          failed = true;
-          if(status == VerifyStatus::Invalid)
-            exit_code = VERIFY_EXIT_INVALID;
-          else if((status == VerifyStatus::Unsupported) &&
-                  (exit_code != VERIFY_EXIT_INVALID))
-            exit_code = VERIFY_EXIT_UNSUPPORTED;
-          else if((status == VerifyStatus::Unsigned) &&
-                  (exit_code == 0))
-            exit_code = VERIFY_EXIT_UNSIGNED;
-        }
-      results.push_back({filepath.generic_string(),status,reason});
+  return {filepath_.generic_string(),status,reason};
+}
+
+static
+void
+_flush_log(const VerifyLog &log_)
+{
+  if(!log_.out.empty())
+    fmt::print("{}",log_.out);
+  if(!log_.err.empty())
+    fmt::print(stderr,"{}",log_.err);
+  if(log_.buffered)
+    std::fflush(stdout);
+}
+
+static
+void
+_verify_images(const Options::Verify     &opts_,
+               TDO::PayloadDigests       *digests_,
+               const std::string         &format_,
+               const bool                 quiet_,
+               std::vector<VerifyResult> &results_)
+{
+  const u64 count = opts_.filepaths.size();
+  const bool buffered = (std::min<u64>(opts_.jobs,count) > 1);
+  std::vector<VerifyLog> logs(count,VerifyLog{quiet_,buffered,{},{}});
+
+  results_.resize(count);
+  OrderedJobs::run(count,
+                   opts_.jobs,
+                   [&](const u64 i_)
+                   {
+                     results_[i_] = _verify_image(opts_.filepaths[i_],
+                                                  opts_,
+                                                  digests_,
+                                                  format_,
+                                                  logs[i_]);
+                   },
+                   [&](const u64 i_)
+                   {
+                     _flush_log(logs[i_]);
+                     logs[i_] = VerifyLog{};
+                   });
+}
+
+static
+int
+_verify(const Options::Verify &opts_,
+        TDO::PayloadDigests   *digests_)
+{
+  bool quiet;
+  bool failed;
+  int exit_code;
+  std::string format;
+  std::vector<VerifyResult> results;
+
+  format = opts_.format.empty() ? "human" : opts_.format;
+
+  quiet = (opts_.quiet || !opts_.verbose || (format != "human"));
+  _verify_images(opts_,digests_,format,quiet,results);
+
+  failed = false;
+  exit_code = 0;
+  for(const auto &result : results)
+    {
+      if(result.status == VerifyStatus::Valid)
+        continue;
+
+      failed = true;
+      if(result.status == VerifyStatus::Invalid)
+        exit_code = VERIFY_EXIT_INVALID;
+      else if((result.status == VerifyStatus::Unsupported) &&
+              (exit_code != VERIFY_EXIT_INVALID))
+        exit_code = VERIFY_EXIT_UNSUPPORTED;
+      else if((result.status == VerifyStatus::Unsigned) &&
+              (exit_code == 0))
+        exit_code = VERIFY_EXIT_UNSIGNED;
     }
 
   if(!opts_.internal)
@@ -20,6 +20,8 @@
 
 #include "tdo_disc_label.hpp"
 #include "tdo_linked_mem_file_entry.hpp"
+#include "tdo_payload_digests.hpp"
+#include "tdo_record_codec.hpp"
 #include "tdo_safe_narrow.hpp"
 
 #include <algorithm>
@@ -30,16 +32,20 @@
 #include <limits>
 #include <stdexcept>
 
+#if !defined(_WIN32)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
 static constexpr int TDO_SECTOR_SIZE = 2048;
 static constexpr int CDROM_SECTOR_SIZE = 2352;
 static constexpr int SYNC_PATTERN_SIZE = 12;
 static constexpr u64 MAX_RECOGNITION_SCAN_BYTES = 1024 * 1024;
 static constexpr u32 MAX_DIRECTORY_AVATAR_INDEX = ROOT_HIGHEST_AVATAR;
-static constexpr u32 DIRECTORY_HEADER_SIZE = sizeof(TDO::DirectoryHeader);
+static constexpr u32 DIRECTORY_HEADER_SIZE = TDO::Codec::Layout<TDO::DirectoryHeader>::size;
 static constexpr u32 M1_MAX_ROMTAG_BLOCK_SIZE = 2048;
 static constexpr u32 M1_RSA_SIGNATURE_SIZE = 64;
 static constexpr u32 M2_MAX_ROMTAG_BLOCK_SIZE = 8192;
-typedef std::array<u8,CDROM_SECTOR_SIZE> CDROMSectorBuf;
 typedef std::array<u8,SYNC_PATTERN_SIZE> CDROMSyncPatternBuf;
 typedef std::array<u8,VOLUME_SYNC_BYTE_LEN> VolumeSyncByteBuf;
 static constexpr CDROMSyncPatternBuf MODE1_SYNC_PATTERN = {0x00,0xFF,0xFF,0xFF,
@@ -178,22 +184,104 @@ TDO::DevStream::DevStream(std::iostream &ios_)
     _device_block_footer(0),
     _data_start_offset(0),
     _disc_label_size_in_bytes(0),
+    _image_size_in_bytes(-1),
+    _image_size_is_valid(false),
     _disc_label_block(0),
     _romtags_block(0),
     _romtags_entry_count(0),
     _romtags_entry_count_is_explicit(false),
-    _ios(ios_)
+    _ios(ios_),
+    _mapped(nullptr),
+    _fd(-1),
+    _digests(nullptr)
+{
+}
+
+// Finds the first RECORD_STD_VOLUME byte followed by the volume sync
+// run. memchr is vectorized in the C libraries we build against and
+// skips most of the buffer; only candidate bytes get the full compare.
+static
+s64
+_scan_for_label(const char *buf_,
+                const u64   size_)
+{
+  static constexpr u64 PATTERN_SIZE = (1 + VOLUME_SYNC_BYTE_LEN);
+  const char *p;
+  const char *end;
+
+  if(size_ < PATTERN_SIZE)
+    return -1;
+
+  p   = buf_;
+  end = (buf_ + size_ - PATTERN_SIZE + 1);
+  while(p < end)
+    {
+      p = static_cast<const char*>(std::memchr(p,RECORD_STD_VOLUME,end - p));
+      if(p == nullptr)
+        return -1;
+      if(std::memcmp(p + 1,&VOLUME_SYNC_BYTES[0],VOLUME_SYNC_BYTE_LEN) == 0)
+        return (p - buf_);
+      p++;
+    }
+
+  return -1;
+}
+
+static
+bool
+_is_mode1_2352(const char *buf_,
+               const u64   size_)
 {
+  if(size_ < CDROM_SECTOR_SIZE)
+    return false;
+
+  const bool has_mode1_sync_pattern =
+    (memcmp(buf_,&MODE1_SYNC_PATTERN[0],MODE1_SYNC_PATTERN.size()) == 0);
+  const bool has_mode1_sector_marker = (buf_[0x0F] == 0x01);
+
+  return (has_mode1_sync_pattern && has_mode1_sector_marker);
+}
+
+void
+TDO::DevStream::_set_device_block_layout(const bool mode1_2352_)
+{
+  if(mode1_2352_)
+    {
+      _device_block_header = 16;
+      _device_block_footer = 288;
+    }
+  else
+    {
+      _device_block_header = 0;
+      _device_block_footer = 0;
+    }
 }
 
 void
 TDO::DevStream::find_label()
 {
-  static constexpr std::array<char, 6> PATTERN =
-    {RECORD_STD_VOLUME, VOLUME_SYNC_BYTE, VOLUME_SYNC_BYTE,
-     VOLUME_SYNC_BYTE, VOLUME_SYNC_BYTE, VOLUME_SYNC_BYTE};
   static constexpr u64 CHUNK_SIZE = 65536;
-  static constexpr u64 OVERLAP = PATTERN.size() - 1;
+  static constexpr u64 OVERLAP = VOLUME_SYNC_BYTE_LEN;
+  s64 label_pos;
+
+  // Mapped images are scanned in place.
+  if(_mapped != nullptr)
+    {
+      const u64 size = std::min<u64>(_mapped->size(),
+                                     MAX_RECOGNITION_SCAN_BYTES + OVERLAP);
+
+      _set_device_block_layout(_is_mode1_2352(_mapped->data(),size));
+      label_pos = _scan_for_label(_mapped->data(),size);
+      if(label_pos < 0)
+        throw Error("no OperaFS label was found");
+
+      _ios.clear(_ios.rdstate() & std::ios::badbit);
+      _ios.seekg(label_pos);
+      return;
+    }
+
+  // The first chunk read also answers the Mode 1 question so the
+  // head of the image is read once.
   std::vector<char> buf(CHUNK_SIZE + OVERLAP);
   u64 bytes_scanned = 0;
 
@@ -210,53 +298,39 @@ TDO::DevStream::find_label()
       if(n <= 0)
         break;
 
-      const u64 scan_limit = n - OVERLAP;
-      for(u64 i = 0; i < scan_limit; i++)
+      if(bytes_scanned == 0)
+        _set_device_block_layout(_is_mode1_2352(buf.data(),n));
+
+      label_pos = _scan_for_label(buf.data(),n);
+      if(label_pos >= 0)
         {
-          if(std::memcmp(&buf[i], PATTERN.data(), PATTERN.size()) == 0)
-            {
-              _ios.clear(_ios.rdstate() & std::ios::badbit);
-              _ios.seekg(seek_pos + i);
-              return;
-            }
+          _ios.clear(_ios.rdstate() & std::ios::badbit);
+          _ios.seekg(seek_pos + label_pos);
+          return;
         }
 
-      bytes_scanned += scan_limit;
+      if(static_cast<u64>(n) <= OVERLAP)
+        break;
+      bytes_scanned += (n - OVERLAP);
     }
 
   throw Error("no OperaFS label was found");
 }
 
-bool
-TDO::DevStream::is_mode1_2352()
-{
-  CDROMSectorBuf buf;
-
-  _ios.seekg(0);
-  _ios.read((char*)&buf[0],buf.size());
-
-  const bool has_mode1_sync_pattern =
-    (memcmp(&buf[0],&MODE1_SYNC_PATTERN[0],MODE1_SYNC_PATTERN.size()) == 0);
-  const bool has_mode1_sector_marker = (buf[0x0F] == 0x01);
-
-  return (has_mode1_sync_pattern && has_mode1_sector_marker);
-}
-
 void
 TDO::DevStream::setup()
 {
   TDO::DiscLabel dl;
 
-  if(is_mode1_2352())
-    {
-      _device_block_header = 16;
-      _device_block_footer = 288;
-    }
-  else
-    {
-      _device_block_header = 0;
-      _device_block_footer = 0;
-    }
+  // Memory mapped images are read through the mapping directly. Any
+  // other streambuf (regular files opened for writing, pipes) keeps
+  // using the iostream interface.
+  _mapped = dynamic_cast<TDO::MappedFileBuf*>(_ios.rdbuf());
+
+  // Unmapped images opened read-only come with a descriptor that
+  // positional reads use instead of the shared stream.
+  const auto *ifs = dynamic_cast<const TDO::ImageFStream*>(&_ios);
+  _fd = (((_mapped == nullptr) && (ifs != nullptr)) ? ifs->fd() : -1);
 
   find_label();
 
@@ -282,9 +356,42 @@ TDO::DevStream::setup()
                     ::_div_round_up(_disc_label_size_in_bytes,
                                      _device_block_data_size));
 
+  refresh_geometry();
+
   _ios.seekg(0);
 }
 
+// Directory record parsing bounds-checks every avatar against the
+// device block count. Measuring the image by seeking to the end for
+// each record dominated walks of large directories, so the size is
+// captured once here and reused until a write or resize could have
+// changed it.
+void
+TDO::DevStream::refresh_geometry()
+{
+  s64 size;
+  TDO::PosGuard guard(this);
+
+  _image_size_is_valid = false;
+
+  _ios.seekg(0,_ios.end);
+  if(!_ios.good())
+    return;
+
+  size = _ios.tellg();
+  if(size < 0)
+    return;
+
+  _image_size_in_bytes = size;
+  _image_size_is_valid = true;
+}
+
+void
+TDO::DevStream::invalidate_geometry()
+{
+  _image_size_is_valid = false;
+}
+
 static
 bool
 is_romfs(TDO::DevStream &stream_)
@@ -484,21 +591,27 @@ TDO::DevStream::device_block_size() const
 u64
 TDO::DevStream::device_block_count()
 {
-  TDO::PosGuard guard(*this);
-
-  // Check failbit on the seek and use file_tell() (which throws on
-  // tellg == -1) rather than letting a failed seek leave tellg at -1.
-  // streamoff(-1) / u64(blocksize) undergoes the usual arithmetic
-  // conversion (signed -> unsigned) producing 0xFFFF... / blocksize,
-  // a huge u64 that silently bypasses downstream end-bound checks
-  // such as safe_romtag_first_data_block's offset+1 >= file_blocks
-  // guard.
-  _ios.seekg(0,_ios.end);
-  if(!_ios.good())
+  // Check for a failed measurement rather than letting a -1 size
+  // leak through. streamoff(-1) / u64(blocksize) undergoes the usual
+  // arithmetic conversion (signed -> unsigned) producing
+  // 0xFFFF... / blocksize, a huge u64 that silently bypasses
+  // downstream end-bound checks such as
+  // safe_romtag_first_data_block's offset+1 >= file_blocks guard.
+  const s64 size = size_in_bytes();
+  if(size < 0)
     throw Error("stream seek to end failed in device_block_count");
 
-  const s64 pos = file_tell();
-  return (static_cast<u64>(pos) / device_block_size());
+  return (static_cast<u64>(size) / device_block_size());
+}
+
+s64
+TDO::DevStream::data_byte_to_file_offset(s64 data_byte_) const
+{
+  return _data_byte_to_file_offset(data_byte_,
+                                   _data_start_offset,
+                                   _device_block_header,
+                                   _device_block_data_size,
+                                   device_block_size());
 }
 
 s64
@@ -716,6 +829,16 @@ TDO::DevStream::read(char      *buf_,
   if(!_ios.good())
     _throw("bad stream state before read");
 
+  if(_mapped != nullptr)
+    {
+      if(_mapped->read(buf_,size_) != size_)
+        {
+          _ios.setstate(std::ios::eofbit|std::ios::failbit);
+          _throw("bad stream state after read");
+        }
+      return;
+    }
+
   _ios.read(buf_,size_);
 
   if(!_ios.good())
@@ -726,6 +849,11 @@ void
 TDO::DevStream::write(const char *buf_,
                       const u64   size_)
 {
+  invalidate_geometry();
+
+  if(_digests)
+    _digests->invalidate(data_byte_tell(),size_);
+
   _ios.write(buf_,size_);
   if(!_ios.good())
     _throw("bad stream state after write");
@@ -762,29 +890,314 @@ void
 TDO::DevStream::read_data_bytes(char     *buf_,
                                const s64 pos_,
                                const s64 bytes_)
+{
+  if(_mapped != nullptr)
+    return _read_mapped_data_bytes(buf_,pos_,bytes_);
+  if(bytes_ <= 0)
+    return;
+
+  // Without a device block header or footer the data bytes are
+  // contiguous in the image so the whole request is one read. This
+  // covers ISOs and ROM dumps whose 4 byte "blocks" would otherwise
+  // cost a seek and a read each.
+  if((_device_block_header == 0) && (_device_block_footer == 0))
+    {
+      data_byte_seek(pos_);
+      read(buf_,bytes_);
+      return;
+    }
+
+  _read_interleaved_data_bytes(buf_,pos_,bytes_);
+}
+
+void
+TDO::DevStream::_read_interleaved_data_bytes(char     *buf_,
+                                             const s64 pos_,
+                                             const s64 bytes_)
+{
+  _gather_interleaved_data_bytes(buf_,
+                                 pos_,
+                                 bytes_,
+                                 [this](char *run_, const s64 file_offset_, const s64 size_)
+                                 {
+                                   file_seek(file_offset_);
+                                   read(run_,size_);
+                                 });
+}
+
+// Reads runs of whole device blocks in one request each through
+// read_run_ and copies the payloads out of the run in memory. Each
+// run is trimmed to end at the last data byte wanted so a stream read
+// is left positioned just past it, as it would be after reading block
+// by block.
+template<typename ReadRunFunc>
+void
+TDO::DevStream::_gather_interleaved_data_bytes(char          *buf_,
+                                               const s64      pos_,
+                                               const s64      bytes_,
+                                               ReadRunFunc  &&read_run_)
+{
+  static constexpr s64 MAX_RUN_BLOCKS = 64;
+
+  const s64 header          = static_cast<s64>(_device_block_header);
+  const s64 dev_block_size  = static_cast<s64>(device_block_size());
+  const s64 data_block_size = static_cast<s64>(device_block_data_size());
+  std::vector<char> run;
+  s64 pos;
+  s64 bytes_read;
+
+  bytes_read = 0;
+  pos = pos_;
+  for(s64 bytes_left = bytes_; bytes_left > 0;)
+    {
+      const s64 file_offset = data_byte_to_file_offset(pos);
+      const s64 block_start = (file_offset - (file_offset % dev_block_size));
+      const s64 in_block    = (file_offset - block_start - header);
+      const s64 run_bytes   =
+        std::min(bytes_left,(MAX_RUN_BLOCKS * data_block_size) - in_block);
+      const s64 last        = (in_block + run_bytes - 1);
+      const s64 run_size    = (((last / data_block_size) * dev_block_size) +
+                               header +
+                               (last % data_block_size) +
+                               1);
+
+      run.resize(run_size);
+      read_run_(run.data(),block_start,run_size);
+
+      for(s64 offset = in_block, copied = 0; copied < run_bytes;)
+        {
+          const s64 block  = (offset / data_block_size);
+          const s64 within = (offset % data_block_size);
+          const s64 count  = std::min(data_block_size - within,run_bytes - copied);
+
+          std::memcpy(&buf_[bytes_read + copied],
+                      &run[(block * dev_block_size) + header + within],
+                      count);
+
+          offset += count;
+          copied += count;
+        }
+
+      pos        += run_bytes;
+      bytes_left -= run_bytes;
+      bytes_read += run_bytes;
+    }
+}
+
+// Reads bytes_ from the image file at file_offset_ without touching
+// the stream or any other shared state.
+void
+TDO::DevStream::_pread_fd(char *buf_,
+                          s64   file_offset_,
+                          s64   bytes_) const
+{
+#if !defined(_WIN32)
+  while(bytes_ > 0)
+    {
+      ssize_t rv;
+
+      rv = ::pread(_fd,buf_,bytes_,file_offset_);
+      if((rv < 0) && (errno == EINTR))
+        continue;
+      if(rv < 0)
+        throw Error(fmt::format("failed to read image at offset {}: {}",
+                                file_offset_,
+                                std::strerror(errno)));
+      if(rv == 0)
+        throw Error(fmt::format("read beyond end of image at offset {}",
+                                file_offset_));
+
+      buf_         += rv;
+      file_offset_ += rv;
+      bytes_       -= rv;
+    }
+#else
+  (void)buf_;
+  (void)file_offset_;
+  (void)bytes_;
+  throw Error("positional reads are not supported on this platform");
+#endif
+}
+
+// Gathers the data bytes from each device block's payload in the
+// mapping. Every device block range is checked against the mapping
+// before copying. On success file_offset_ is just past the last byte
+// copied; on failure it is where the unreadable range starts.
+bool
+TDO::DevStream::_copy_mapped_data_bytes(char      *buf_,
+                                        const s64  pos_,
+                                        const s64  bytes_,
+                                        u64       &file_offset_) const
 {
   s64 pos;
   s64 bytes_read;
   s64 bytes_to_read;
   s64 block_size;
+  const char *data = _mapped->data();
+  const u64 size = _mapped->size();
+  // Without a device block header or footer the data bytes are
+  // contiguous in the image so the whole request is one copy.
+  const bool contiguous = ((_device_block_header == 0) &&
+                           (_device_block_footer == 0));
 
-  bytes_read = 0;
   block_size = device_block_data_size();
 
+  file_offset_ = 0;
+  bytes_read = 0;
   pos = pos_;
   for(s64 bytes_left = bytes_; bytes_left > 0;)
     {
-      data_byte_seek(pos);
+      file_offset_ = _data_byte_to_file_offset(pos,
+                                               _data_start_offset,
+                                               _device_block_header,
+                                               _device_block_data_size,
+                                               device_block_size());
+
+      bytes_to_read = (contiguous ?
+                       bytes_left :
+                       std::min(block_size - (pos % block_size),bytes_left));
+
+      if((file_offset_ > size) ||
+         (static_cast<u64>(bytes_to_read) > (size - file_offset_)))
+        return false;
+
+      std::memcpy(&buf_[bytes_read],&data[file_offset_],bytes_to_read);
+
+      file_offset_ += bytes_to_read;
+      pos          += bytes_to_read;
+      bytes_left   -= bytes_to_read;
+      bytes_read   += bytes_to_read;
+    }
+
+  return true;
+}
 
-      bytes_to_read = (block_size - (pos % block_size));
-      bytes_to_read = std::min(bytes_to_read,bytes_left);
+// Same contract as the stream path: the stream is left positioned
+// just past the last byte read.
+void
+TDO::DevStream::_read_mapped_data_bytes(char     *buf_,
+                                        const s64 pos_,
+                                        const s64 bytes_)
+{
+  u64 file_offset;
+
+  if(bytes_ <= 0)
+    return;
+  if(!_ios.good())
+    _throw("bad stream state before read");
+
+  if(!_copy_mapped_data_bytes(buf_,pos_,bytes_,file_offset))
+    {
+      file_seek(std::min(file_offset,_mapped->size()));
+      _ios.setstate(std::ios::eofbit|std::ios::failbit);
+      _throw("bad stream state after read");
+    }
+
+  file_seek(file_offset);
+}
+
+void
+TDO::DevStream::pread_data_bytes(char     *buf_,
+                                 const s64 pos_,
+                                 const s64 bytes_)
+{
+  if(bytes_ <= 0)
+    return;
+
+  if(_mapped != nullptr)
+    {
+      u64 file_offset;
+
+      if(!_copy_mapped_data_bytes(buf_,pos_,bytes_,file_offset))
+        throw Error(fmt::format("read beyond end of image at offset {}",
+                                file_offset));
+      return;
+    }
+
+  if(_fd >= 0)
+    {
+      if((_device_block_header == 0) && (_device_block_footer == 0))
+        return _pread_fd(buf_,data_byte_to_file_offset(pos_),bytes_);
+
+      return _gather_interleaved_data_bytes(buf_,
+                                            pos_,
+                                            bytes_,
+                                            [this](char *run_, const s64 file_offset_, const s64 size_)
+                                            {
+                                              _pread_fd(run_,file_offset_,size_);
+                                            });
+    }
+
+  // Fallback for streams without a mapping or descriptor.
+  std::lock_guard<std::mutex> lock(_pread_mutex);
+  TDO::PosGuard guard(*this);
+
+  read_data_bytes(buf_,pos_,bytes_);
+}
+
+void
+TDO::DevStream::pread_data_bytes_from_block(char     *buf_,
+                                            const s64 block_pos_,
+                                            const s64 bytes_)
+{
+  pread_data_bytes(buf_,
+                   (block_pos_ * device_block_data_size()),
+                   bytes_);
+}
+
+TDO::DataView
+TDO::DevStream::data_bytes_view(const s64 pos_,
+                                const s64 bytes_)
+{
+  TDO::DataView view;
+
+  if(bytes_ <= 0)
+    return view;
+
+  if((_mapped != nullptr) &&
+     (_device_block_header == 0) &&
+     (_device_block_footer == 0))
+    {
+      u64 file_offset;
+      const u64 size = _mapped->size();
+
+      if(!_ios.good())
+        _throw("bad stream state before read");
+
+      file_offset = _data_byte_to_file_offset(pos_,
+                                              _data_start_offset,
+                                              _device_block_header,
+                                              _device_block_data_size,
+                                              device_block_size());
+      if((file_offset > size) ||
+         (static_cast<u64>(bytes_) > (size - file_offset)))
+        {
+          file_seek(std::min(file_offset,size));
+          _ios.setstate(std::ios::eofbit|std::ios::failbit);
+          _throw("bad stream state after read");
+        }
 
-      read(&buf_[bytes_read],bytes_to_read);
+      view._data = &_mapped->data()[file_offset];
+      view._size = static_cast<u64>(bytes_);
+      file_seek(file_offset + bytes_);
 
-      pos        += bytes_to_read;
-      bytes_left -= bytes_to_read;
-      bytes_read += bytes_to_read;
+      return view;
     }
+
+  view._buf.resize(bytes_);
+  read_data_bytes(view._buf.data(),pos_,bytes_);
+  view._data = view._buf.data();
+  view._size = view._buf.size();
+
+  return view;
+}
+
+TDO::DataView
+TDO::DevStream::data_bytes_view_from_block(const s64 block_pos_,
+                                           const s64 bytes_)
+{
+  return data_bytes_view((block_pos_ * device_block_data_size()),
+                         bytes_);
 }
 
 void
@@ -865,21 +1278,10 @@ void
 TDO::DevStream::read(TDO::DiscLabel &dl_)
 {
   TDO::DiscLabel tmp;
+  TDO::Codec::Buffer<TDO::DiscLabel> buf;
 
-  read(tmp.record_type);
-  read(tmp.volume_sync_bytes);
-  read(tmp.volume_structure_version);
-  read(tmp.volume_flags);
-  read(tmp.volume_commentary);
-  read(tmp.volume_identifier);
-  read(tmp.volume_unique_identifier);
-  read(tmp.volume_block_size);
-  read(tmp.volume_block_count);
-  read(tmp.root_unique_identifier);
-  read(tmp.root_directory_block_count);
-  read(tmp.root_directory_block_size);
-  read(tmp.root_directory_last_avatar_index);
-  read(tmp.root_directory_avatar_list);
+  read(buf.data(),buf.size());
+  TDO::Codec::decode(buf.data(),tmp);
 
   if(tmp.record_type != RECORD_STD_VOLUME)
     _throw("invalid OperaFS disc label: incorrect record type");
@@ -916,177 +1318,222 @@ TDO::DevStream::read(TDO::DiscLabel &dl_)
 void
 TDO::DevStream::write(const TDO::DiscLabel &dl_)
 {
-  write(dl_.record_type);
-  write(dl_.volume_sync_bytes);
-  write(dl_.volume_structure_version);
-  write(dl_.volume_flags);
-  write(dl_.volume_commentary);
-  write(dl_.volume_identifier);
-  write(dl_.volume_unique_identifier);
-  write(dl_.volume_block_size);
-  write(dl_.volume_block_count);
-  write(dl_.root_unique_identifier);
-  write(dl_.root_directory_block_count);
-  write(dl_.root_directory_block_size);
-  write(dl_.root_directory_last_avatar_index);
-  write(dl_.root_directory_avatar_list);
+  TDO::Codec::Buffer<TDO::DiscLabel> buf;
+
+  TDO::Codec::encode(buf.data(),dl_);
+  write(buf.data(),buf.size());
 }
 
 void
 TDO::DevStream::read(TDO::DirectoryHeader &dh_)
 {
   TDO::DirectoryHeader tmp;
+  TDO::Codec::Buffer<TDO::DirectoryHeader> buf;
 
-  read(tmp.next_block);
-  read(tmp.prev_block);
-  read(tmp.flags);
-  read(tmp.first_free_byte);
-  read(tmp.first_entry_offset);
+  read(buf.data(),buf.size());
+  TDO::Codec::decode(buf.data(),tmp);
 
-  const u64 dev_block_count = device_block_count();
-
-  if(tmp.next_block < -1)
-    _throw("unsafe OperaFS directory metadata: invalid next_block");
-  if(tmp.prev_block < -1)
-    _throw("unsafe OperaFS directory metadata: invalid prev_block");
-  if((tmp.next_block != -1) &&
-     (static_cast<u64>(tmp.next_block) >= dev_block_count))
-    _throw("unsafe OperaFS directory metadata: next_block exceeds device bounds");
-  if((tmp.prev_block != -1) &&
-     (static_cast<u64>(tmp.prev_block) >= dev_block_count))
-    _throw("unsafe OperaFS directory metadata: prev_block exceeds device bounds");
-  if(tmp.first_free_byte < DIRECTORY_HEADER_SIZE)
-    _throw("unsafe OperaFS directory metadata: first_free_byte overlaps header");
-  if(tmp.first_entry_offset < DIRECTORY_HEADER_SIZE)
-    _throw("unsafe OperaFS directory metadata: first_entry_offset overlaps header");
-  if(tmp.first_entry_offset > tmp.first_free_byte)
-    _throw("unsafe OperaFS directory metadata: first_entry_offset exceeds first_free_byte");
+  _validate(tmp,static_cast<std::streamoff>(_ios.tellg()));
 
   dh_ = tmp;
 }
 
+void
+TDO::DevStream::_validate(const TDO::DirectoryHeader &dh_,
+                          const s64                   file_pos_)
+{
+  const u64 dev_block_count = device_block_count();
+
+  if(dh_.next_block < -1)
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory metadata: invalid next_block");
+  if(dh_.prev_block < -1)
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory metadata: invalid prev_block");
+  if((dh_.next_block != -1) &&
+     (static_cast<u64>(dh_.next_block) >= dev_block_count))
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory metadata: next_block exceeds device bounds");
+  if((dh_.prev_block != -1) &&
+     (static_cast<u64>(dh_.prev_block) >= dev_block_count))
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory metadata: prev_block exceeds device bounds");
+  if(dh_.first_free_byte < DIRECTORY_HEADER_SIZE)
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory metadata: first_free_byte overlaps header");
+  if(dh_.first_entry_offset < DIRECTORY_HEADER_SIZE)
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory metadata: first_entry_offset overlaps header");
+  if(dh_.first_entry_offset > dh_.first_free_byte)
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory metadata: first_entry_offset exceeds first_free_byte");
+}
+
 void
 TDO::DevStream::read(TDO::DirectoryRecord &dr_)
 {
   TDO::DirectoryRecord tmp;
+  TDO::Codec::Buffer<TDO::DirectoryRecord> buf;
   std::array<u32,MAX_DIRECTORY_AVATAR_INDEX + 1> avatar_list;
+  std::array<char,sizeof(avatar_list)> avatar_buf;
 
-  read(tmp.flags);
-  read(tmp.unique_identifier);
-  read(tmp.type);
-  read(tmp.block_size);
-  read(tmp.byte_count);
-  read(tmp.block_count);
-  read(tmp.burst);
-  read(tmp.gap);
-  read(tmp.filename,32);
-  read(tmp.last_avatar_index);
+  read(buf.data(),buf.size());
+  TDO::Codec::decode(buf.data(),tmp);
 
   if(tmp.last_avatar_index > MAX_DIRECTORY_AVATAR_INDEX)
     _throw("impossible OperaFS directory record last_avatar_index: {} > {}",
            tmp.last_avatar_index,MAX_DIRECTORY_AVATAR_INDEX);
 
-  for(u32 i = 0; i <= tmp.last_avatar_index; i++)
-    read(avatar_list[i]);
+  read(avatar_buf.data(),(tmp.last_avatar_index + 1) * sizeof(u32));
+  TDO::Codec::load_be32_array(avatar_buf.data(),
+                              avatar_list.data(),
+                              tmp.last_avatar_index + 1);
 
   tmp.avatar_list.assign(avatar_list.begin(),
                          avatar_list.begin() + (tmp.last_avatar_index + 1));
 
-  const u32 avatar_count = tmp.last_avatar_index + 1;
+  _validate(tmp,static_cast<std::streamoff>(_ios.tellg()));
+
+  dr_ = tmp;
+}
+
+void
+TDO::DevStream::_validate(const TDO::DirectoryRecord &dr_,
+                          const s64                   file_pos_)
+{
+  const u32 avatar_count = dr_.last_avatar_index + 1;
   const u32 data_block_size = device_block_data_size();
 
-  if(tmp.avatar_list.size() != avatar_count)
-    _throw("impossible OperaFS directory record avatar count: avatar_list.size()={} last_avatar_index+1={}",
-           tmp.avatar_list.size(),avatar_count);
-  if(tmp.block_size == 0)
-    _throw("unsafe OperaFS directory record metadata: zero block_size");
-  if((data_block_size == 0) || ((tmp.block_size % data_block_size) != 0))
-    _throw("unsafe OperaFS directory record metadata: invalid block_size alignment");
+  if(dr_.avatar_list.size() != avatar_count)
+    _throw_at(file_pos_,
+              "impossible OperaFS directory record avatar count: avatar_list.size()={} last_avatar_index+1={}",
+              dr_.avatar_list.size(),avatar_count);
+  if(dr_.block_size == 0)
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory record metadata: zero block_size");
+  if((data_block_size == 0) || ((dr_.block_size % data_block_size) != 0))
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory record metadata: invalid block_size alignment");
 
   const u64 dev_block_count = device_block_count();
   const u64 record_dev_block_count =
-    (static_cast<u64>(tmp.block_count) *
-     (static_cast<u64>(tmp.block_size) / data_block_size));
+    (static_cast<u64>(dr_.block_count) *
+     (static_cast<u64>(dr_.block_size) / data_block_size));
   const u64 max_byte_count =
-    static_cast<u64>(tmp.block_size) * static_cast<u64>(tmp.block_count);
-
-  if((tmp.block_count == 0) && (avatar_count > 1))
-    _throw("unsafe OperaFS directory record metadata: avatars without blocks");
-  if((tmp.byte_count != 0) && (tmp.block_count == 0))
-    _throw("unsafe OperaFS directory record metadata: byte_count without blocks");
-  if((tmp.block_count != 0) && (tmp.byte_count > max_byte_count))
-    _throw("unsafe OperaFS directory record metadata: byte_count exceeds block capacity");
-
-  if(tmp.block_count != 0)
+    static_cast<u64>(dr_.block_size) * static_cast<u64>(dr_.block_count);
+
+  if((dr_.block_count == 0) && (avatar_count > 1))
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory record metadata: avatars without blocks");
+  if((dr_.byte_count != 0) && (dr_.block_count == 0))
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory record metadata: byte_count without blocks");
+  if((dr_.block_count != 0) && (dr_.byte_count > max_byte_count))
+    _throw_at(file_pos_,
+              "unsafe OperaFS directory record metadata: byte_count exceeds block capacity");
+
+  if(dr_.block_count != 0)
     {
       if(record_dev_block_count > dev_block_count)
-        _throw("unsafe OperaFS directory record metadata: block_count exceeds device bounds");
+        _throw_at(file_pos_,
+                  "unsafe OperaFS directory record metadata: block_count exceeds device bounds");
 
-      for(u32 avatar : tmp.avatar_list)
+      for(u32 avatar : dr_.avatar_list)
         {
           if(avatar >= dev_block_count)
-            _throw("unsafe OperaFS directory record metadata: avatar exceeds device bounds");
+            _throw_at(file_pos_,
+                      "unsafe OperaFS directory record metadata: avatar exceeds device bounds");
           if(static_cast<u64>(avatar) >
              (dev_block_count - record_dev_block_count))
-            _throw("unsafe OperaFS directory record metadata: avatar extent exceeds device bounds");
+            _throw_at(file_pos_,
+                      "unsafe OperaFS directory record metadata: avatar extent exceeds device bounds");
         }
     }
+}
+
+u64
+TDO::DevStream::parse(const char           *buf_,
+                      const u64             size_,
+                      const s64             data_pos_,
+                      TDO::DirectoryHeader &dh_)
+{
+  using Layout = TDO::Codec::Layout<TDO::DirectoryHeader>;
+  TDO::DirectoryHeader tmp;
+
+  if(size_ < Layout::size)
+    return 0;
+
+  TDO::Codec::decode(buf_,tmp);
+
+  _validate(tmp,data_byte_to_file_offset(data_pos_ + Layout::size));
+
+  dh_ = tmp;
+
+  return Layout::size;
+}
+
+u64
+TDO::DevStream::parse(const char           *buf_,
+                      const u64             size_,
+                      const s64             data_pos_,
+                      TDO::DirectoryRecord &dr_)
+{
+  using Layout = TDO::Codec::Layout<TDO::DirectoryRecord>;
+  TDO::DirectoryRecord tmp;
+  u64 record_size;
+
+  if(size_ < Layout::size)
+    return 0;
+
+  TDO::Codec::decode(buf_,tmp);
+
+  if(tmp.last_avatar_index > MAX_DIRECTORY_AVATAR_INDEX)
+    _throw_at(data_byte_to_file_offset(data_pos_ + Layout::size),
+              "impossible OperaFS directory record last_avatar_index: {} > {}",
+              tmp.last_avatar_index,MAX_DIRECTORY_AVATAR_INDEX);
+
+  record_size = (Layout::size + ((tmp.last_avatar_index + 1) * sizeof(u32)));
+  if(size_ < record_size)
+    return 0;
+
+  tmp.avatar_list.resize(tmp.last_avatar_index + 1);
+  TDO::Codec::load_be32_array(buf_ + Layout::size,
+                              tmp.avatar_list.data(),
+                              tmp.avatar_list.size());
+
+  _validate(tmp,data_byte_to_file_offset(data_pos_ + record_size));
 
   dr_ = tmp;
+
+  return record_size;
 }
 
 void
 TDO::DevStream::read(TDO::ROMTag &tag_)
 {
-  read(tag_.sub_systype);
-  read(tag_.type);
-  read(tag_.version);
-  read(tag_.revision);
-  read(tag_.flags);
-  read(tag_.type_specific);
-  read(tag_.reserved1);
-  read(tag_.reserved2);
-  read(tag_.offset);
-  read(tag_.size);
-  read(tag_.reserved3[0]);
-  read(tag_.reserved3[1]);
-  read(tag_.reserved3[2]);
-  read(tag_.reserved3[3]);
+  TDO::Codec::Buffer<TDO::ROMTag> buf;
+
+  read(buf.data(),buf.size());
+  TDO::Codec::decode(buf.data(),tag_);
 }
 
 void
 TDO::DevStream::write(const TDO::ROMTag &tag_)
 {
-  write(tag_.sub_systype);
-  write(tag_.type);
-  write(tag_.version);
-  write(tag_.revision);
-  write(tag_.flags);
-  write(tag_.type_specific);
-  write(tag_.reserved1);
-  write(tag_.reserved2);
-  write(tag_.offset);
-  write(tag_.size);
-  write(tag_.reserved3[0]);
-  write(tag_.reserved3[1]);
-  write(tag_.reserved3[2]);
-  write(tag_.reserved3[3]);
+  TDO::Codec::Buffer<TDO::ROMTag> buf;
+
+  TDO::Codec::encode(buf.data(),tag_);
+  write(buf.data(),buf.size());
 }
 
 void
 TDO::DevStream::read(TDO::LinkedMemFileEntry &lmfe_)
 {
   TDO::LinkedMemFileEntry tmp;
+  TDO::Codec::Buffer<TDO::LinkedMemFileEntry> buf;
 
-  read(tmp.fingerprint);
-  read(tmp.flink_offset);
-  read(tmp.blink_offset);
-  read(tmp.block_count);
-  read(tmp.header_block_count);
-  read(tmp.byte_count);
-  read(tmp.unique_identifier);
-  read(tmp.type);
-  read(tmp.filename,sizeof(tmp.filename));
+  read(buf.data(),buf.size());
+  TDO::Codec::decode(buf.data(),tmp);
 
   if((tmp.fingerprint != FINGERPRINT_FILEBLOCK) &&
      (tmp.fingerprint != FINGERPRINT_FREEBLOCK) &&
@@ -1111,13 +1558,12 @@ TDO::DevStream::read(TDO::LinkedMemFileEntry &lmfe_)
 s64
 TDO::DevStream::size_in_bytes()
 {
-  s64 size;
-  TDO::PosGuard guard(this);
+  if(!_image_size_is_valid)
+    refresh_geometry();
+  if(!_image_size_is_valid)
+    return -1;
 
-  _ios.seekg(0,_ios.end);
-  size = _ios.tellg();
-
-  return size;
+  return _image_size_in_bytes;
 }
 
 s64
@@ -1149,6 +1595,8 @@ TDO::DevStream::resize_multiple(s64 multiple_)
   if(rounded_size == size)
     return;
 
+  invalidate_geometry();
+
   _ios.seekp(rounded_size - 1);
   _ios.put(0);
   if(!_ios)
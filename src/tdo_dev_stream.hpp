@@ -23,17 +23,53 @@
 #include "tdo_directory_header.hpp"
 #include "tdo_directory_record.hpp"
 #include "tdo_disc_label.hpp"
+#include "tdo_image_fstream.hpp"
 #include "tdo_linked_mem_file_entry.hpp"
 #include "tdo_romtag.hpp"
 #include "types_ints.h"
 
 #include <array>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <utility>
+#include <vector>
 
 namespace TDO
 {
+  class PayloadDigests;
+
+  // Read-only view of a range of data bytes. For memory mapped images
+  // without device block headers the view points straight into the
+  // mapping. Otherwise the bytes are gathered into storage owned by
+  // the view. Either way the view must not outlive its DevStream.
+  class DataView
+  {
+  public:
+    DataView()
+      : _data(nullptr),
+        _size(0)
+    {
+    }
+
+    DataView(const DataView&) = delete;
+    DataView(DataView&&) = default;
+    DataView& operator=(const DataView&) = delete;
+    DataView& operator=(DataView&&) = default;
+
+  public:
+    const char *data() const { return _data; }
+    u64 size() const { return _size; }
+    bool empty() const { return (_size == 0); }
+
+  private:
+    friend class DevStream;
+
+    const char        *_data;
+    u64                _size;
+    std::vector<char>  _buf;
+  };
+
   class DevStream
   {
   private:
@@ -42,6 +78,8 @@ namespace TDO
     u64 _device_block_footer;
     u64 _data_start_offset;
     u64 _disc_label_size_in_bytes;
+    s64 _image_size_in_bytes;
+    bool _image_size_is_valid;
 
   private:
     s64 _file_pos_to_data_byte_pos(const s64 pos_) const;
@@ -52,11 +90,17 @@ namespace TDO
     u32  _romtags_entry_count;
     bool _romtags_entry_count_is_explicit;
     std::iostream &_ios;
+    TDO::MappedFileBuf *_mapped;
+    int _fd;
+    std::mutex _pread_mutex;
+    TDO::PayloadDigests *_digests;
 
   public:
     DevStream(std::iostream &ios);
 
   public:
+    // Detects the device block layout and positions the stream at the
+    // disc label in one pass over the head of the image.
     void find_label();
     void setup();
 
@@ -64,13 +108,27 @@ namespace TDO
     bool good() const { return _ios.good(); }
     bool bad() const { return _ios.bad(); }
     bool eof() const { return _ios.eof(); }
+    bool is_mapped() const { return (_mapped != nullptr); }
+    // True when pread_data_bytes() never touches the shared stream so
+    // several threads may call it while others use the stream.
+    bool has_concurrent_pread() const { return ((_mapped != nullptr) || (_fd >= 0)); }
     std::iostream &iostream() { return _ios; }
 
+  public:
+    // Every write is reported to digests so hash state of the bytes it
+    // replaces is dropped. digests must outlive its use here.
+    void set_payload_digests(TDO::PayloadDigests *digests) { _digests = digests; }
+    TDO::PayloadDigests *payload_digests() const { return _digests; }
+
   public:
     s64 size_in_bytes();
     s64 size_in_device_blocks();
     void resize_multiple(s64 multiple);
 
+  public:
+    void refresh_geometry();
+    void invalidate_geometry();
+
   public:
     u64 data_offset() const;
     u64 data_start_offset() const;
@@ -101,6 +159,7 @@ namespace TDO
     s64 device_block_tell() const;
 
   public:
+    s64 data_byte_to_file_offset(const s64) const;
     s64 data_block_to_file_offset(const s64) const;
 
   public:
@@ -142,6 +201,42 @@ namespace TDO
     void read_data_bytes(char     *buf_,
                          const s64 pos_,
                          const s64 bytes_);
+    TDO::DataView data_bytes_view(const s64 byte_pos,
+                                  const s64 bytes);
+    TDO::DataView data_bytes_view_from_block(const s64 block_pos,
+                                             const s64 bytes);
+
+  public:
+    // Positional reads. The position is explicit and the stream cursor
+    // is left alone, so no PosGuard is needed. Memory mapped images are
+    // copied from the mapping and other files opened read-only are
+    // read with pread(2) on their own descriptor; both may be called
+    // from several threads at once. Only as a fallback, for iostreams
+    // that are not backed by such a file (pipes, images opened for
+    // writing), the read seeks the shared stream and restores the
+    // cursor. That is only serialized against other pread calls and
+    // is thread safe only while nothing else uses the stream.
+    void pread_data_bytes(char     *buf,
+                          const s64 pos,
+                          const s64 bytes);
+    void pread_data_bytes_from_block(char     *buf,
+                                     const s64 block_pos,
+                                     const s64 bytes);
+
+  public:
+    // Decode a header or record from data bytes already in memory,
+    // such as a whole directory block fetched in one read. data_pos
+    // is the data byte position buf was read from and is only used
+    // in error messages. Both apply the same validation as read() and
+    // return the number of bytes consumed, or 0 if buf ends first.
+    u64 parse(const char           *buf,
+              const u64             size,
+              const s64             data_pos,
+              TDO::DirectoryHeader &dh);
+    u64 parse(const char           *buf,
+              const u64             size,
+              const s64             data_pos,
+              TDO::DirectoryRecord &dr);
 
     template<std::size_t N>
     void
@@ -196,19 +291,50 @@ namespace TDO
 
   private:
     u64 _romtags_count_impl();
+    bool _copy_mapped_data_bytes(char      *buf,
+                                 const s64  pos,
+                                 const s64  bytes,
+                                 u64       &file_offset) const;
+    void _read_mapped_data_bytes(char     *buf,
+                                 const s64 pos,
+                                 const s64 bytes);
+    void _read_interleaved_data_bytes(char     *buf,
+                                      const s64 pos,
+                                      const s64 bytes);
+    template<typename ReadRunFunc>
+    void _gather_interleaved_data_bytes(char          *buf,
+                                        const s64      pos,
+                                        const s64      bytes,
+                                        ReadRunFunc  &&read_run);
+    void _pread_fd(char     *buf,
+                   s64       file_offset,
+                   s64       bytes) const;
 
   private:
-    bool is_mode1_2352();
+    void _set_device_block_layout(const bool mode1_2352);
+    void _validate(const TDO::DirectoryHeader &dh,
+                   const s64                   file_pos);
+    void _validate(const TDO::DirectoryRecord &dr,
+                   const s64                   file_pos);
 
   private:
     template<typename... Args>
     void
     _throw(const char *fmt_, Args&&... args_)
+    {
+      _throw_at(static_cast<std::streamoff>(_ios.tellg()),
+                fmt_,
+                std::forward<Args>(args_)...);
+    }
+
+    template<typename... Args>
+    void
+    _throw_at(const s64 file_pos_, const char *fmt_, Args&&... args_)
     {
       std::string msg;
 
       msg = fmt::format(fmt_,std::forward<Args>(args_)...);
-      msg += fmt::format(" at offset {}",static_cast<std::streamoff>(_ios.tellg()));
+      msg += fmt::format(" at offset {}",file_pos_);
 
       throw Error(msg);
     }
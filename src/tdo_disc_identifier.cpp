@@ -78,6 +78,7 @@ find_matches(const TDO::DiscLabel       &label_,
 }
 
 TDO::DiscIdentifier::DiscIdentifier()
+  : tier(TDO::IdentifyTier::Filesystem)
 {
 }
 
@@ -95,4 +96,33 @@ TDO::DiscIdentifier::identify(std::iostream &ios_)
 
   ::find_matches(label,fsstats,full_matches,partial_matches);
   disc_image_ext = ::get_ext_based_on_type(stream);
+  tier = TDO::IdentifyTier::Filesystem;
+}
+
+void
+TDO::DiscIdentifier::identify_tiered(std::iostream &ios_)
+{
+  TDO::DevStream stream(ios_);
+
+  stream.setup();
+
+  stream.data_byte_seek(0);
+  stream.read(label);
+
+  disc_image_ext = ::get_ext_based_on_type(stream);
+
+  // tdo_disc_ids_equal() treats zero file_count and total_data_size as
+  // wildcards so zeroed stats match on label fields alone.
+  ::find_matches(label,fsstats,full_matches,partial_matches);
+  if(full_matches.size() == 1)
+    {
+      tier = TDO::IdentifyTier::Label;
+      return;
+    }
+
+  full_matches.clear();
+  partial_matches.clear();
+  fsstats.collect(stream);
+  ::find_matches(label,fsstats,full_matches,partial_matches);
+  tier = TDO::IdentifyTier::Filesystem;
 }
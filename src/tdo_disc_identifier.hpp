@@ -27,6 +27,12 @@
 
 namespace TDO
 {
+  enum class IdentifyTier
+    {
+      Label,
+      Filesystem
+    };
+
   class DiscIdentifier
   {
   public:
@@ -34,8 +40,13 @@ namespace TDO
 
   public:
     void identify(std::iostream &ios_);
+    // Matches on disc label fields first and only walks the filesystem
+    // when the label does not select exactly one entry. fsstats is
+    // left zeroed when the label decides.
+    void identify_tiered(std::iostream &ios_);
 
   public:
+    IdentifyTier tier;
     std::string disc_image_ext;
     TDO::DiscLabel label;
     TDO::FilesystemStats fsstats;
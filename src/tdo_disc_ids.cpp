@@ -19,8 +19,96 @@
 #include "tdo_disc_ids.hpp"
 
 #include <algorithm>
+#include <cstdint>
+#include <utility>
 
 
+namespace
+{
+  typedef std::pair<std::uint64_t,const TDO::ID*> IndexEntry;
+  typedef std::vector<IndexEntry> Index;
+
+  // Sorted views of TDOID_LIST keyed by volume unique id, root unique
+  // id and (file_count,total_data_size). Built once on first lookup so
+  // the list stays the only thing to edit when adding discs. Ties sort
+  // by list position so every range comes back in list order.
+  struct Indexes
+  {
+    Index by_vui;
+    Index by_rui;
+    Index by_size;
+
+    Indexes()
+    {
+      for(const TDO::ID *cur = TDO::disc_ids_start(); cur->name; cur++)
+        {
+          by_vui.emplace_back(cur->volume_unique_id,cur);
+          by_rui.emplace_back(cur->root_unique_id,cur);
+          if(cur->file_count && cur->total_data_size)
+            by_size.emplace_back(size_key(*cur),cur);
+        }
+
+      std::sort(by_vui.begin(),by_vui.end());
+      std::sort(by_rui.begin(),by_rui.end());
+      std::sort(by_size.begin(),by_size.end());
+    }
+
+    static
+    std::uint64_t
+    size_key(const TDO::ID &id_)
+    {
+      return ((static_cast<std::uint64_t>(id_.file_count) << 32) |
+              id_.total_data_size);
+    }
+  };
+
+  static
+  const Indexes&
+  indexes()
+  {
+    static const Indexes idx;
+
+    return idx;
+  }
+
+  struct KeyLess
+  {
+    bool
+    operator()(const IndexEntry    &a_,
+               const std::uint64_t  b_) const
+    {
+      return (a_.first < b_);
+    }
+
+    bool
+    operator()(const std::uint64_t  a_,
+               const IndexEntry    &b_) const
+    {
+      return (a_ < b_.first);
+    }
+  };
+
+  static
+  std::pair<Index::const_iterator,Index::const_iterator>
+  lookup(const Index         &index_,
+         const std::uint64_t  key_)
+  {
+    return std::equal_range(index_.begin(),index_.end(),key_,KeyLess());
+  }
+
+  static
+  void
+  append_range(const Index          &index_,
+               const std::uint64_t   key_,
+               TDO::IDVec           &ids_)
+  {
+    const auto range = lookup(index_,key_);
+
+    for(auto i = range.first; i != range.second; ++i)
+      ids_.push_back(i->second);
+  }
+}
+
 namespace TDO
 {
   const
@@ -37,42 +125,60 @@ namespace TDO
     return tdo_disc_ids_end();
   }
 
+  // Every full match shares the volume unique id, so only that bucket
+  // needs tdo_disc_ids_equal.
   const
   ID*
   disc_ids_find(const ID &id_,
                 const ID *prev_)
   {
-    return tdo_disc_ids_find(&id_,prev_);
+    const auto range = lookup(indexes().by_vui,id_.volume_unique_id);
+
+    for(auto i = range.first; i != range.second; ++i)
+      {
+        if(prev_ && (i->second <= prev_))
+          continue;
+        if(tdo_disc_ids_equal(&id_,i->second))
+          return i->second;
+      }
+
+    return NULL;
   }
 
   void
   disc_ids_find_full_matches(const ID &id_,
                              IDVec    &matches_)
   {
-    const TDO::ID *cur;
+    const auto range = lookup(indexes().by_vui,id_.volume_unique_id);
 
-    cur = NULL;
-    while(true)
+    for(auto i = range.first; i != range.second; ++i)
       {
-        cur = TDO::disc_ids_find(id_,cur);
-        if(cur == NULL)
-          break;
-        matches_.push_back(cur);
+        if(tdo_disc_ids_equal(&id_,i->second))
+          matches_.push_back(i->second);
       }
   }
 
+  // tdo_disc_ids_equalish() is a union of three key matches; collect
+  // the three buckets and restore list order.
   void
   disc_ids_find_partial_matches(const ID    &id_,
                                 const IDVec &full_matches_,
                                 IDVec       &partial_matches_)
   {
-    const TDO::ID *cur;
+    IDVec candidates;
+    const Indexes &idx = indexes();
 
-    cur = TDO::disc_ids_start();
-    for(; cur->name; cur++)
+    append_range(idx.by_vui,id_.volume_unique_id,candidates);
+    append_range(idx.by_rui,id_.root_unique_id,candidates);
+    if(id_.file_count && id_.total_data_size)
+      append_range(idx.by_size,Indexes::size_key(id_),candidates);
+
+    std::sort(candidates.begin(),candidates.end());
+    candidates.erase(std::unique(candidates.begin(),candidates.end()),
+                     candidates.end());
+
+    for(const ID *cur : candidates)
       {
-        if(!tdo_disc_ids_equalish(&id_,cur))
-          continue;
         if(std::find(full_matches_.begin(),full_matches_.end(),cur) != full_matches_.end())
           continue;
         partial_matches_.push_back(cur);
@@ -18,10 +18,13 @@
 
 #include "tdo_disc_packer.hpp"
 
-#include "copy_stream.hpp"
+#include "file_copier.hpp"
 #include "tdo_directory_record.hpp"
 #include "tdo_disc_format.hpp"
 #include "tdo_disc_label.hpp"
+#include "tdo_file_stream.hpp"
+#include "tdo_payload_digests.hpp"
+#include "tdo_record_codec.hpp"
 
 #include <algorithm>
 #include <array>
@@ -35,31 +38,6 @@ namespace
   using Entry = TDO::DiscManifestEntry;
   using EntryKind = TDO::DiscManifestEntryKind;
 
-  static
-  void
-  write_u8(std::ostream &os_,
-           u8            value_)
-  {
-    os_.put(static_cast<char>(value_));
-  }
-
-  static
-  void
-  write_u32(std::ostream &os_,
-            u32           value_)
-  {
-    u32 be = __builtin_bswap32(value_);
-    os_.write(reinterpret_cast<const char*>(&be), sizeof(be));
-  }
-
-  static
-  void
-  write_s32(std::ostream &os_,
-            s32           value_)
-  {
-    write_u32(os_,static_cast<u32>(value_));
-  }
-
   static
   void
   write_bytes(std::ostream &os_,
@@ -77,22 +55,6 @@ namespace
     os_.seekp(static_cast<std::streamoff>(block_) * TDO::BLOCK_SIZE,std::ios::beg);
   }
 
-  static
-  void
-  write_fixed_string(std::ostream      &os_,
-                     const std::string &str_,
-                     u32                size_)
-  {
-    const u32 len = std::min<u32>(str_.size(), size_ - 1);
-    os_.write(str_.c_str(), len);
-    const u32 padding = size_ - len;
-    if(padding > 0)
-      {
-        std::vector<char> zeros(padding, '\0');
-        os_.write(zeros.data(), padding);
-      }
-  }
-
   static
   TDO::DiscLabel
   make_disc_label(const TDO::DiscManifest &manifest_)
@@ -119,146 +81,171 @@ namespace
   write_disc_label(std::ostream         &os_,
                    const TDO::DiscLabel &label_)
   {
+    TDO::Codec::Buffer<TDO::DiscLabel> buf;
+
+    TDO::Codec::encode(buf.data(),label_);
+
     seek_block(os_,0);
-    write_u8(os_,label_.record_type);
-    write_bytes(os_,&label_.volume_sync_bytes[0],label_.volume_sync_bytes.size());
-    write_u8(os_,label_.volume_structure_version);
-    write_u8(os_,label_.volume_flags);
-    write_bytes(os_,&label_.volume_commentary[0],label_.volume_commentary.size());
-    write_bytes(os_,&label_.volume_identifier[0],label_.volume_identifier.size());
-    write_u32(os_,label_.volume_unique_identifier);
-    write_u32(os_,label_.volume_block_size);
-    write_u32(os_,label_.volume_block_count);
-    write_u32(os_,label_.root_unique_identifier);
-    write_u32(os_,label_.root_directory_block_count);
-    write_u32(os_,label_.root_directory_block_size);
-    write_u32(os_,label_.root_directory_last_avatar_index);
-    for(auto block : label_.root_directory_avatar_list)
-      write_u32(os_,block);
+    write_bytes(os_,buf.data(),buf.size());
   }
 
   static
   void
-  write_directory_header(std::ostream &os_,
-                         s32           next_block_,
-                         s32           prev_block_,
-                         u32           first_free_byte_)
+  encode_directory_header(char *p_,
+                          s32   next_block_,
+                          s32   prev_block_,
+                          u32   first_free_byte_)
   {
-    write_s32(os_,next_block_);
-    write_s32(os_,prev_block_);
-    write_u32(os_,0);
-    write_u32(os_,first_free_byte_);
-    write_u32(os_,TDO::DIRECTORY_HEADER_SIZE);
+    TDO::DirectoryHeader dh;
+
+    dh.next_block         = next_block_;
+    dh.prev_block         = prev_block_;
+    dh.flags              = 0;
+    dh.first_free_byte    = first_free_byte_;
+    dh.first_entry_offset = TDO::DIRECTORY_HEADER_SIZE;
+
+    TDO::Codec::encode(p_,dh);
   }
 
   static
-  void
-  write_directory_record(std::ostream &os_,
-                         const Entry  &entry_,
-                         u32           extra_flags_)
+  u32
+  encode_directory_record(char        *p_,
+                          const Entry &entry_,
+                          u32          extra_flags_)
   {
-    write_u32(os_,entry_.flags | extra_flags_);
-    write_u32(os_,entry_.unique_identifier);
-    write_u32(os_,entry_.type);
-    write_u32(os_,entry_.block_size);
-    write_u32(os_,entry_.byte_count);
-    write_u32(os_,entry_.block_count);
-    write_u32(os_,entry_.burst);
-    write_u32(os_,entry_.gap);
-    write_fixed_string(os_,entry_.name,FILESYSTEM_MAX_NAME_LEN);
+    TDO::DirectoryRecord dr = {};
+
+    dr.flags             = (entry_.flags | extra_flags_);
+    dr.unique_identifier = entry_.unique_identifier;
+    dr.type              = entry_.type;
+    dr.block_size        = entry_.block_size;
+    dr.byte_count        = entry_.byte_count;
+    dr.block_count       = entry_.block_count;
+    dr.burst             = entry_.burst;
+    dr.gap               = entry_.gap;
+    entry_.name.copy(dr.filename,
+                     std::min<std::size_t>(entry_.name.size(),
+                                           FILESYSTEM_MAX_NAME_LEN - 1));
     if(entry_.avatar_list.empty())
       {
         if(entry_.block_count != 0)
           throw Error(fmt::format("packer: entry '{}' has block_count={} but no avatars",
                                   entry_.name,entry_.block_count));
-        write_u32(os_,0);
-        write_u32(os_,entry_.start_block);
+        dr.last_avatar_index = 0;
+        dr.avatar_list.assign(1,entry_.start_block);
       }
     else
       {
-        write_u32(os_,entry_.avatar_list.size() - 1);
-        for(auto avatar : entry_.avatar_list)
-          write_u32(os_,avatar);
+        dr.last_avatar_index = (entry_.avatar_list.size() - 1);
+        dr.avatar_list = entry_.avatar_list;
       }
+
+    TDO::Codec::encode(p_,dr);
+    TDO::Codec::store_be32_array(p_ + TDO::DIRECTORY_RECORD_BASE_SIZE,
+                                 dr.avatar_list.data(),
+                                 dr.avatar_list.size());
+
+    return TDO::record_size(entry_);
   }
 
+  // The children [begin,end) of a directory that share one block.
+  struct DirectoryBlock
+  {
+    std::size_t begin;
+    std::size_t end;
+    u32         first_free_byte;
+  };
+
+  // Same packing rule as TDO::directory_block_count() but records
+  // where every block starts so rendering needs no rescans.
   static
-  std::vector<const Entry*>
-  directory_block_entries(const Entry &dir_,
-                          u32         block_index_,
-                          u32        &first_free_byte_)
+  std::vector<DirectoryBlock>
+  partition_directory(const Entry &dir_)
   {
-    std::vector<const Entry*> entries;
-    u32 current_block;
-    u32 used;
+    std::vector<DirectoryBlock> blocks;
+    DirectoryBlock block;
 
-    current_block = 0;
-    used          = TDO::DIRECTORY_HEADER_SIZE;
-    for(const auto &child : dir_.children)
+    if(dir_.children.empty())
+      return blocks;
+
+    block.begin           = 0;
+    block.first_free_byte = TDO::DIRECTORY_HEADER_SIZE;
+    for(std::size_t i = 0; i < dir_.children.size(); i++)
       {
         u32 size;
 
-        size = TDO::record_size(*child);
-        if((used + size) > TDO::BLOCK_SIZE)
+        size = TDO::record_size(*dir_.children[i]);
+        if((block.first_free_byte + size) > TDO::BLOCK_SIZE)
           {
-            if(current_block == block_index_)
-              break;
-            current_block++;
-            used = TDO::DIRECTORY_HEADER_SIZE;
+            block.end = i;
+            blocks.push_back(block);
+            block.begin           = i;
+            block.first_free_byte = TDO::DIRECTORY_HEADER_SIZE;
           }
 
-        if(current_block == block_index_)
-          entries.push_back(child.get());
-
-        used += size;
+        block.first_free_byte += size;
       }
 
-    first_free_byte_ = used;
+    block.end = dir_.children.size();
+    blocks.push_back(block);
 
-    return entries;
+    return blocks;
   }
 
+  // Renders every block of the directory into one buffer which is
+  // then written to each avatar with a single write.
   static
   void
   write_directory(std::ostream &os_,
                   const Entry  &dir_)
   {
+    std::vector<char> buf;
+    std::vector<DirectoryBlock> blocks;
+
     if(!dir_.directory || (dir_.block_count == 0))
       return;
 
-    const u32 used_block_count = TDO::directory_block_count(dir_);
+    blocks = partition_directory(dir_);
+    buf.assign(static_cast<std::size_t>(dir_.block_count) * TDO::BLOCK_SIZE,0);
+    for(u32 i = 0; i < dir_.block_count; i++)
+      {
+        char *p;
+        s32 next_block;
+        s32 prev_block;
+
+        p = &buf[static_cast<std::size_t>(i) * TDO::BLOCK_SIZE];
+        next_block = ((i + 1) < dir_.block_count ? i + 1 : -1);
+        prev_block = (i > 0 ? i - 1 : -1);
+
+        if(i >= blocks.size())
+          {
+            encode_directory_header(p,next_block,prev_block,TDO::DIRECTORY_HEADER_SIZE);
+            continue;
+          }
+
+        const DirectoryBlock &block = blocks[i];
+
+        encode_directory_header(p,next_block,prev_block,block.first_free_byte);
+        p += TDO::DIRECTORY_HEADER_SIZE;
+        for(std::size_t j = block.begin; j < block.end; j++)
+          {
+            u32 flags;
+
+            flags = 0;
+            if((j + 1) == block.end)
+              {
+                flags = DR_FLAG_LAST_IN_BLOCK;
+                if((i + 1) == blocks.size())
+                  flags |= DR_FLAG_LAST_IN_DIR;
+              }
+            p += encode_directory_record(p,*dir_.children[j],flags);
+          }
+      }
+
     auto write_avatar = [&](u32 avatar)
     {
-      for(u32 i = 0; i < dir_.block_count; i++)
-        {
-          s32 next_block;
-          s32 prev_block;
-          u32 first_free_byte;
-          std::vector<const Entry*> entries;
-
-          if(i < used_block_count)
-            entries = directory_block_entries(dir_,i,first_free_byte);
-          else
-            first_free_byte = TDO::DIRECTORY_HEADER_SIZE;
-          next_block = ((i + 1) < dir_.block_count ? i + 1 : -1);
-          prev_block = (i > 0 ? i - 1 : -1);
-
-          seek_block(os_,avatar + i);
-          write_directory_header(os_,next_block,prev_block,first_free_byte);
-          for(std::size_t j = 0; j < entries.size(); j++)
-            {
-              u32 flags;
-
-              flags = 0;
-              if((j + 1) == entries.size())
-                {
-                  flags = DR_FLAG_LAST_IN_BLOCK;
-                  if((i + 1) == used_block_count)
-                    flags |= DR_FLAG_LAST_IN_DIR;
-                }
-              write_directory_record(os_,*entries[j],flags);
-            }
-        }
+      seek_block(os_,avatar);
+      write_bytes(os_,buf.data(),buf.size());
     };
     if(dir_.avatar_list.empty())
       write_avatar(dir_.start_block);
@@ -270,19 +257,167 @@ namespace
       write_directory(os_,*child);
   }
 
+  // The disc image file data is being copied out of. Only one is open
+  // at a time; in practice every entry shares the same image.
+  class ImageSource
+  {
+  public:
+    TDO::DevStream&
+    open(const std::filesystem::path &path_)
+    {
+      if(!_stream || (_stream->filepath() != path_))
+        {
+          _stream = std::make_unique<TDO::FileStream>();
+          _stream->open(path_);
+        }
+
+      return *_stream;
+    }
+
+  private:
+    std::unique_ptr<TDO::FileStream> _stream;
+  };
+
+  // Wraps read_ so every chunk it returns is also hashed as the bytes
+  // bound for data byte dst_pos_ of the output.
+  static
+  util::FileCopier::ReadFunc
+  hashing_reader(util::FileCopier::ReadFunc  read_,
+                 TDO::PayloadDigests        &digests_,
+                 const u64                   dst_pos_)
+  {
+    return [read_,&digests_,dst_pos_](char *buf_, const u64 pos_, const u64 size_)
+    {
+      read_(buf_,pos_,size_);
+      digests_.update(dst_pos_ + pos_,buf_,size_);
+    };
+  }
+
+  // The rest of a hashed file's allocation is the zero fill left by
+  // resize_output(). Signed extents may reach into it.
+  static
+  void
+  hash_allocation_tail(TDO::PayloadDigests &digests_,
+                       const Entry         &entry_,
+                       const u64            dst_pos_)
+  {
+    static const std::array<char,TDO::BLOCK_SIZE> zeros{};
+    const u64 end = (dst_pos_ +
+                     (static_cast<u64>(entry_.block_count) * TDO::BLOCK_SIZE));
+
+    for(u64 pos = (dst_pos_ + entry_.data_byte_count); pos < end;)
+      {
+        const u64 n = std::min<u64>(zeros.size(),end - pos);
+
+        digests_.update(pos,zeros.data(),n);
+        pos += n;
+      }
+  }
+
+  static
+  void
+  copy_image_data(util::FileCopier    &copier_,
+                  ImageSource         &images_,
+                  TDO::PayloadDigests *digests_,
+                  const Entry         &entry_,
+                  std::vector<u64>    &offsets_)
+  {
+    TDO::DevStream &stream = images_.open(entry_.src_path);
+    const u64 len = entry_.data_byte_count;
+
+    // Without device block headers or footers the file's data bytes
+    // are one range of the image file and the kernel can copy them.
+    if((digests_ == nullptr) &&
+       (stream.device_block_header() == 0) &&
+       (stream.device_block_footer() == 0))
+      {
+        const s64 offset = stream.data_byte_to_file_offset(entry_.src_image_pos);
+
+        if((offset < 0) ||
+           ((static_cast<u64>(offset) + len) > static_cast<u64>(stream.size_in_bytes())))
+          throw Error("file data extends beyond source image: " +
+                      entry_.src_path.string());
+
+        copier_.copy(entry_.src_path,offset,len,offsets_);
+        return;
+      }
+
+    util::FileCopier::ReadFunc read =
+      [&](char *buf_, const u64 pos_, const u64 size_)
+      {
+        stream.pread_data_bytes(buf_,entry_.src_image_pos + pos_,size_);
+      };
+
+    if(digests_)
+      read = hashing_reader(read,*digests_,offsets_[0]);
+
+    copier_.copy(read,entry_.src_path,len,offsets_);
+  }
+
+  // A regular file read through memory so it can be hashed.
   static
   void
-  copy_file_data(std::ostream &os_,
-                 const Entry  &entry_)
+  copy_hashed_file(util::FileCopier    &copier_,
+                   TDO::PayloadDigests &digests_,
+                   const Entry         &entry_,
+                   std::vector<u64>    &offsets_)
   {
     std::ifstream is;
+
+    is.open(entry_.src_path,std::ios::binary);
+    if(!is)
+      throw Error("failed to open input file: " + entry_.src_path.string());
+
+    auto read = [&](char *buf_, const u64 pos_, const u64 size_)
+    {
+      is.seekg(static_cast<std::streamoff>(pos_),std::ios::beg);
+      is.read(buf_,static_cast<std::streamsize>(size_));
+      if(!is)
+        throw Error("failed to read input file: " + entry_.src_path.string());
+    };
+
+    copier_.copy(hashing_reader(read,digests_,offsets_[0]),
+                 entry_.src_path,
+                 entry_.data_byte_count,
+                 offsets_);
+  }
+
+  static
+  void
+  copy_file_data(util::FileCopier    &copier_,
+                 ImageSource         &images_,
+                 TDO::PayloadDigests *digests_,
+                 const Entry         &entry_)
+  {
     u64 src_size;
+    std::vector<u64> offsets;
+    TDO::PayloadDigests *digests;
 
     if(entry_.kind != EntryKind::Normal)
       return;
     if(entry_.directory || (entry_.block_count == 0))
       return;
 
+    if(entry_.avatar_list.empty())
+      offsets.push_back(static_cast<u64>(entry_.start_block) * TDO::BLOCK_SIZE);
+    else
+      for(auto avatar : entry_.avatar_list)
+        offsets.push_back(static_cast<u64>(avatar) * TDO::BLOCK_SIZE);
+
+    // Digests cover the first copy only, which is the one ROMTags
+    // point at.
+    digests = (((digests_ != nullptr) && digests_->tracks(offsets[0])) ?
+               digests_ :
+               nullptr);
+
+    if(entry_.src_is_image)
+      {
+        copy_image_data(copier_,images_,digests,entry_,offsets);
+        if(digests)
+          hash_allocation_tail(*digests,entry_,offsets[0]);
+        return;
+      }
+
     {
       std::error_code ec;
       src_size = std::filesystem::file_size(entry_.src_path,ec);
@@ -294,48 +429,28 @@ namespace
       throw Error("input file shrank since manifest was built: " +
                   entry_.src_path.string());
 
-    is.open(entry_.src_path,std::ios::binary);
-    if(!is)
-      throw Error("failed to open input file: " + entry_.src_path.string());
-
-    auto write_one = [&](u32 block_)
-    {
-      is.clear();
-      is.seekg(0,std::ios::beg);
-      if(!is)
-        throw Error("failed to seek input file: " + entry_.src_path.string());
-
-      seek_block(os_,block_);
-      if(!os_)
-        throw Error("failed to seek output image while writing " +
-                    entry_.src_path.string());
-
-      util::copy_stream(is,os_,entry_.data_byte_count);
-
-      if(os_.fail())
-        throw Error("failed to write file data for " +
-                    entry_.src_path.string());
-      if(is.bad())
-        throw Error("read error on input file: " + entry_.src_path.string());
-    };
+    if(digests == nullptr)
+      {
+        copier_.copy(entry_.src_path,0,entry_.data_byte_count,offsets);
+        return;
+      }
 
-    if(entry_.avatar_list.empty())
-      write_one(entry_.start_block);
-    else
-      for(auto avatar : entry_.avatar_list)
-        write_one(avatar);
+    copy_hashed_file(copier_,*digests,entry_,offsets);
+    hash_allocation_tail(*digests,entry_,offsets[0]);
   }
 
   static
   void
-  write_file_data(std::ostream &os_,
-                  const Entry  &entry_)
+  write_file_data(util::FileCopier    &copier_,
+                  ImageSource         &images_,
+                  TDO::PayloadDigests *digests_,
+                  const Entry         &entry_)
   {
     if(!entry_.directory)
-      copy_file_data(os_,entry_);
+      copy_file_data(copier_,images_,digests_,entry_);
 
     for(const auto &child : entry_.children)
-      write_file_data(os_,*child);
+      write_file_data(copier_,images_,digests_,*child);
   }
 
   static
@@ -368,7 +483,8 @@ namespace
 }
 
 void
-TDO::pack_disc_image(const TDO::DiscManifest &manifest_)
+TDO::pack_disc_image(const TDO::DiscManifest &manifest_,
+                     TDO::PayloadDigests     *digests_)
 {
   TDO::DiscLabel label;
   std::ofstream os;
@@ -383,7 +499,18 @@ TDO::pack_disc_image(const TDO::DiscManifest &manifest_)
   resize_output(os,manifest_.total_blocks);
   write_disc_label(os,label);
   write_directory(os,manifest_.root);
-  write_file_data(os,manifest_.root);
+
+  // File data may be written through a second descriptor so
+  // everything buffered so far has to reach the file first.
+  os.flush();
+  if(!os)
+    throw Error("failed to flush output image: " + manifest_.output.string());
+  {
+    ImageSource images;
+    util::FileCopier copier(manifest_.output,os);
+
+    write_file_data(copier,images,digests_,manifest_.root);
+  }
 
   os.flush();
   if(!os)
@@ -22,6 +22,7 @@
 #include "tdo_disc_format.hpp"
 #include "tdo_romtag.hpp"
 #include "tdo_disc_label.hpp"
+#include "tdo_record_codec.hpp"
 #include "types_ints.h"
 
 #include <filesystem>
@@ -44,6 +45,10 @@ namespace TDO
     typedef std::unique_ptr<DiscManifestEntry> Ptr;
 
     std::filesystem::path              src_path;
+    // When set src_path is a disc image and the data starts at data
+    // byte src_image_pos of it rather than at the start of the file.
+    bool                               src_is_image;
+    u64                                src_image_pos;
     std::string                        name;
     DiscManifestEntryKind              kind;
     bool                               directory;
@@ -73,10 +78,17 @@ namespace TDO
     DiscManifestEntry     root;
   };
 
-  void pack_disc_image(const DiscManifest &manifest);
+  class PayloadDigests;
 
-  constexpr u32 DIRECTORY_HEADER_SIZE = 20;
-  constexpr u32 DIRECTORY_RECORD_BASE_SIZE = 68;
+  // Ranges tracked by digests are hashed as their file data is
+  // written, see PayloadDigests.
+  void pack_disc_image(const DiscManifest &manifest,
+                       PayloadDigests     *digests = nullptr);
+
+  constexpr u32 DIRECTORY_HEADER_SIZE =
+    TDO::Codec::Layout<TDO::DirectoryHeader>::size;
+  constexpr u32 DIRECTORY_RECORD_BASE_SIZE =
+    TDO::Codec::Layout<TDO::DirectoryRecord>::size;
 
   static inline
   u32
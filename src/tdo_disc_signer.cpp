@@ -22,11 +22,13 @@
 #include "fmt.hpp"
 #include "fmt_md5_digest.hpp"
 #include "fmt_rsa512_sig.hpp"
-#include "nonstd/string.hpp"
+#include "log.hpp"
 #include "tdo_boot_code_crypto.hpp"
 #include "tdo_disc_format.hpp"
 #include "tdo_file_stream.hpp"
+#include "tdo_fs_index.hpp"
 #include "tdo_fs_walker.hpp"
+#include "tdo_payload_digests.hpp"
 #include "tdo_romtag_metadata.hpp"
 #include "tdo_rsa.hpp"
 #include "version.hpp"
@@ -279,7 +281,6 @@ namespace
                                          TDO::ROMTag                &romtag_,
                                          const TDO::DirectoryRecord &record_)
   {
-    std::vector<char> data;
     const TDO::ROMTagVersionRevisionFallback *fallback;
 
     // For byte-count types the fallback table keys on the full on-disc
@@ -296,18 +297,25 @@ namespace
       : romtag_.size;
 
     // The disabled RSA_SIGNATURE_BLOCK placeholder deliberately has no
-    // payload. There is nothing to hash for version/revision inference, and
-    // DevStream's vector overload requires at least one destination byte.
+    // payload. There is nothing to hash for version/revision inference.
     if(data_size == 0)
       return;
 
     if(data_size > static_cast<u64>(std::numeric_limits<s64>::max()))
       throw Error("ROMTag version/revision fallback file is too large");
 
-    stream_.read_data_bytes_from_block(data,
-                                       record_.avatar_list[0],
-                                       static_cast<s64>(data_size));
-    fallback = TDO::find_romtag_version_revision_fallback(romtag_.type,data);
+    fallback = nullptr;
+    if(TDO::has_romtag_version_revision_fallback(romtag_.type))
+      {
+        md5_digest_t digest;
+
+        TDO::md5_data_bytes(stream_,
+                            static_cast<u64>(record_.avatar_list[0]) * TDO::BLOCK_SIZE,
+                            data_size,
+                            digest);
+        fallback = TDO::find_romtag_version_revision_fallback(romtag_.type,
+                                                              digest);
+      }
     if(fallback == nullptr)
       {
         // A known payload hash is authoritative and may correct nonzero junk
@@ -353,60 +361,70 @@ namespace
       throw Error("signing is currently supported only for 2048-byte ISO images");
   }
 
+  // Every signing phase replays the directory records captured once in
+  // an FSIndex rather than walking the image again. Each callback gets a
+  // copy of the record, as it would from FSWalker, so phases that rewrite
+  // record sizes through the index never alias the record they inspect.
+  class SigningFSCallbacks
+  {
+  public:
+    virtual ~SigningFSCallbacks() = default;
+
+    // The second argument is the path lowercased, as stored in the
+    // index.
+    virtual void operator()(const std::filesystem::path&,
+                            const std::string&,
+                            const TDO::DirectoryRecord&,
+                            const u32,
+                            TDO::DevStream&) = 0;
+  };
+
   static
   void
-  update_record_sizes(TDO::DevStream &stream_,
-                      const u32       record_pos_,
-                      const u32       byte_count_,
-                      const u32       block_count_)
+  replay_index(const TDO::FSIndex &index_,
+               TDO::DevStream     &stream_,
+               SigningFSCallbacks &callbacks_)
   {
-    stream_.file_seek(record_pos_);
-    stream_.data_byte_skip(offsetof(TDO::DirectoryRecord,byte_count));
-    stream_.write(byte_count_);
-    stream_.write(block_count_);
+    for(u64 i = 0; i < index_.entries().size(); i++)
+      {
+        const TDO::FSIndex::Entry entry = index_.entries()[i];
+
+        callbacks_(entry.path,entry.lc_path,entry.record,entry.record_pos,stream_);
+      }
   }
 
-  class SigningFSCallbacks : public TDO::FSWalker::Callbacks
+  class ROMTagsFileUpdater final : public SigningFSCallbacks
   {
   public:
-    Error
-    invalid_filename(const std::filesystem::path &,
-                     const std::string           &,
-                     const TDO::DirectoryRecord  &,
-                     const uint32_t,
-                     const Error                 &,
-                     TDO::DevStream              &) override
-    {
-      // Retail mastering output can contain otherwise harmless records with
-      // path-separator names (the German Panasonic sampler is one example).
-      // They cannot name any exact signing target below, and FSWalker cannot
-      // safely recurse through them, so skip those records just as list and
-      // unpack do instead of making an unrelated filename block re-signing.
-      return Error();
-    }
-  };
+    TDO::FSIndex &index;
+    u32           romtags_file_size;
 
-  class ROMTagsFileUpdater final : public SigningFSCallbacks
-  {
   public:
-    u32 romtags_file_size;
+    ROMTagsFileUpdater(TDO::FSIndex &index_,
+                       const u32     romtags_file_size_)
+      : index(index_),
+        romtags_file_size(romtags_file_size_)
+    {
+    }
 
   public:
     void
     operator()(const std::filesystem::path &filepath_,
+               const std::string           &lc_filepath_,
                const TDO::DirectoryRecord  &record_,
                const u32                    record_pos_,
                TDO::DevStream              &stream_)
     {
+      (void)filepath_;
       (void)record_;
 
-      if(nonstd::string::as_lowercase(filepath_.generic_string()) != "rom_tags")
+      if(lc_filepath_ != "rom_tags")
         return;
 
-      update_record_sizes(stream_,
-                          record_pos_,
-                          romtags_file_size,
-                          TDO::div_round_up(romtags_file_size,TDO::BLOCK_SIZE));
+      index.update_record_sizes(stream_,
+                                record_pos_,
+                                romtags_file_size,
+                                TDO::div_round_up(romtags_file_size,TDO::BLOCK_SIZE));
     }
   };
 
@@ -440,15 +458,15 @@ namespace
     warn(const std::filesystem::path &filepath_,
          const std::string           &reason_)
     {
-      fmt::print(stderr,
-                 "3dt: warning: AIF {} {}; prepare it with modbin\n",
-                 filepath_.generic_string(),
-                 reason_);
+      Log::warning(fmt::format("AIF {} {}; prepare it with modbin",
+                               filepath_.generic_string(),
+                               reason_));
     }
 
   public:
     void
     operator()(const std::filesystem::path &filepath_,
+               const std::string           &lc_filepath_,
                const TDO::DirectoryRecord  &record_,
                const u32                    record_pos_,
                TDO::DevStream              &stream_)
@@ -465,11 +483,9 @@ namespace
 
       (void)record_pos_;
 
-      const std::string lc_filepath =
-        nonstd::string::as_lowercase(filepath_.generic_string());
-      if((lc_filepath == "system/kernel/os_code") ||
-         (lc_filepath == "system/kernel/misc_code") ||
-         (lc_filepath == "system/kernel/boot_code"))
+      if((lc_filepath_ == "system/kernel/os_code") ||
+         (lc_filepath_ == "system/kernel/misc_code") ||
+         (lc_filepath_ == "system/kernel/boot_code"))
         return;
 
       if(record_.is_directory() ||
@@ -564,26 +580,37 @@ namespace
   class SignaturesPlaceholderUpdater final : public SigningFSCallbacks
   {
   public:
-    bool found = false;
+    TDO::FSIndex &index;
+    bool          found;
+
+  public:
+    SignaturesPlaceholderUpdater(TDO::FSIndex &index_)
+      : index(index_),
+        found(false)
+    {
+    }
 
   public:
     void
     operator()(const std::filesystem::path &filepath_,
+               const std::string           &lc_filepath_,
                const TDO::DirectoryRecord  &record_,
                const u32                    record_pos_,
                TDO::DevStream              &stream_)
     {
-      if(nonstd::string::as_lowercase(filepath_.generic_string()) != "signatures")
+      (void)filepath_;
+
+      if(lc_filepath_ != "signatures")
         return;
 
       if(record_.avatar_list.empty() || (record_.block_count == 0))
         throw Error("signatures placeholder has no allocated block");
 
       found = true;
-      update_record_sizes(stream_,
-                          record_pos_,
-                          0,
-                          record_.block_count);
+      index.update_record_sizes(stream_,
+                                record_pos_,
+                                0,
+                                record_.block_count);
     }
   };
 
@@ -625,22 +652,21 @@ namespace
   public:
     void
     operator()(const std::filesystem::path &filepath_,
+               const std::string           &lc_filepath_,
                const TDO::DirectoryRecord  &record_,
                const u32                    record_pos_,
                TDO::DevStream              &stream_)
     {
-      std::string lc_filepath;
-
+      (void)filepath_;
       (void)record_pos_;
       (void)stream_;
 
-      lc_filepath = nonstd::string::as_lowercase(filepath_.generic_string());
-      if(lc_filepath == "rom_tags")
+      if(lc_filepath_ == "rom_tags")
         {
           found_rom_tags = true;
           rom_tags_capacity = static_cast<u64>(record_.block_count) * record_.block_size;
         }
-      else if(lc_filepath == "signatures")
+      else if(lc_filepath_ == "signatures")
         found_signatures = true;
     }
   };
@@ -673,32 +699,32 @@ namespace
   public:
     void
     operator()(const std::filesystem::path &filepath_,
+               const std::string           &lc_filepath_,
                const TDO::DirectoryRecord  &record_,
                const u32                    record_pos_,
                TDO::DevStream              &stream_)
     {
       u32 type;
-      std::string lc_filepath;
 
+      (void)filepath_;
       (void)record_pos_;
       (void)stream_;
 
-      lc_filepath = nonstd::string::as_lowercase(filepath_.generic_string());
-      if(lc_filepath == "rom_tags")
+      if(lc_filepath_ == "rom_tags")
         {
           found_rom_tags = true;
           rom_tags_capacity = static_cast<u64>(record_.block_count) * record_.block_size;
         }
-      else if(lc_filepath == "signatures")
+      else if(lc_filepath_ == "signatures")
         found_signatures = true;
-      else if(lc_filepath == "system/kernel/boot_code")
+      else if(lc_filepath_ == "system/kernel/boot_code")
         found_boot_code = true;
-      else if(lc_filepath == "system/kernel/misc_code")
+      else if(lc_filepath_ == "system/kernel/misc_code")
         found_misc_code = true;
-      else if(lc_filepath == "system/kernel/os_code")
+      else if(lc_filepath_ == "system/kernel/os_code")
         found_os_code = true;
 
-      type = romtag_type_for_path(lc_filepath, include_banner_romtag);
+      type = romtag_type_for_path(lc_filepath_, include_banner_romtag);
       if(type != 0)
         generated_romtag_count++;
     }
@@ -707,6 +733,7 @@ namespace
   class ROMTagsGenerator final : public SigningFSCallbacks
   {
   public:
+    TDO::FSIndex  &index;
     TDO::ROMTagVec romtags;
     bool           include_banner_romtag;
     bool           sign_payloads;
@@ -714,11 +741,13 @@ namespace
     const TDO::ROMTagVec &existing_romtags;
 
   public:
-    ROMTagsGenerator(const bool            include_banner_romtag_,
+    ROMTagsGenerator(TDO::FSIndex         &index_,
+                     const bool            include_banner_romtag_,
                      const bool            sign_payloads_,
                      const TDO::ROMTagVec &authoritative_romtags_,
                      const TDO::ROMTagVec &existing_romtags_)
-      : romtags(),
+      : index(index_),
+        romtags(),
         include_banner_romtag(include_banner_romtag_),
         sign_payloads(sign_payloads_),
         authoritative_romtags(authoritative_romtags_),
@@ -745,14 +774,14 @@ namespace
   public:
     void
     operator()(const std::filesystem::path &filepath_,
+               const std::string           &lc_filepath_,
                const TDO::DirectoryRecord  &record_,
                const u32                    record_pos_,
                TDO::DevStream              &stream_)
     {
       u32 type;
 
-      type = romtag_type_for_path(nonstd::string::as_lowercase(filepath_.generic_string()),
-                                  include_banner_romtag);
+      type = romtag_type_for_path(lc_filepath_,include_banner_romtag);
       if(type == 0)
         return;
 
@@ -781,6 +810,7 @@ namespace
           (type == RSA_APPSPLASH)))
         {
           u64 capacity;
+          u64 head_size;
           u32 inspection_size;
           std::vector<char> data;
           TDO::SignedROMTagPayloadLayout layout;
@@ -793,14 +823,19 @@ namespace
             ((type == RSA_APPSPLASH) ?
              std::min(record_.byte_count,TDO::APP_SPLASH_PAL_PAYLOAD_SIZE) :
              record_.byte_count);
+          head_size = TDO::signed_romtag_payload_head_size(type);
+          head_size = ((head_size == 0) ?
+                       inspection_size :
+                       std::min<u64>(head_size,inspection_size));
           stream_.read_data_bytes_from_block(data,
                                              record_.avatar_list[0],
-                                             inspection_size);
-          layout = TDO::inspect_signed_romtag_payload(type,
-                                                      data,
-                                                      record_.byte_count,
-                                                      size_hint(authoritative_romtags,type),
-                                                      size_hint(existing_romtags,type));
+                                             head_size);
+          layout = TDO::inspect_signed_romtag_payload_head(type,
+                                                           data,
+                                                           inspection_size,
+                                                           record_.byte_count,
+                                                           size_hint(authoritative_romtags,type),
+                                                           size_hint(existing_romtags,type));
           if(layout.signed_size > capacity)
             throw Error(fmt::format("{} needs {} bytes of signature storage but its allocation holds {} bytes; unpack and pack the image to rebuild it",
                                     filepath_.string(),
@@ -817,10 +852,10 @@ namespace
             {
               _vprint("    - normalizing BannerScreen size to {}\n",
                       layout.signed_size);
-              update_record_sizes(stream_,
-                                  record_pos_,
-                                  layout.signed_size,
-                                  record_.block_count);
+              index.update_record_sizes(stream_,
+                                        record_pos_,
+                                        layout.signed_size,
+                                        record_.block_count);
             }
 
           // Portfolio's ROMTag loaders hash the structural payload and read
@@ -876,10 +911,10 @@ namespace
                   _vprint("    - correcting boot_code size to {}\n",
                           *boot_size);
                   romtag.size = *boot_size;
-                  update_record_sizes(stream_,
-                                      record_pos_,
-                                      romtag.size,
-                                      record_.block_count);
+                  index.update_record_sizes(stream_,
+                                            record_pos_,
+                                            romtag.size,
+                                            record_.block_count);
                 }
             }
           else
@@ -1100,6 +1135,7 @@ namespace
   static
   TDO::ROMTagVec
   generate_romtags_for_image(TDO::FileStream &stream_,
+                             TDO::FSIndex    &index_,
                              const bool       include_banner_romtag_,
                              const bool       include_billstuff_romtag_,
                              const bool       sign_payloads_,
@@ -1121,13 +1157,13 @@ namespace
           trusted_romtags.emplace_back(existing);
       }
 
-    ROMTagsGenerator tags(include_banner_romtag_,
+    ROMTagsGenerator tags(index_,
+                          include_banner_romtag_,
                           sign_payloads_,
                           source_romtags_,
                           existing_romtags);
-    TDO::FSWalker fswalker(stream_,tags,false);
 
-    fswalker.walk();
+    replay_index(index_,stream_,tags);
 
     if(include_billstuff_romtag_)
       add_billstuff_romtag(stream_,tags.romtags);
@@ -1161,40 +1197,60 @@ namespace
   static
   void
   update_romtags_file(TDO::FileStream &stream_,
+                      TDO::FSIndex    &index_,
                       const u32        size_)
   {
-    ROMTagsFileUpdater updater;
-    TDO::FSWalker fsw(stream_,updater);
+    ROMTagsFileUpdater updater(index_,size_);
 
-    updater.romtags_file_size = size_;
-    fsw.walk();
+    replay_index(index_,stream_,updater);
   }
 
   static
   void
-  reset_signatures_placeholder(TDO::FileStream &stream_)
+  reset_signatures_placeholder(TDO::FileStream &stream_,
+                               TDO::FSIndex    &index_)
   {
-    SignaturesPlaceholderUpdater updater;
-    TDO::FSWalker fsw(stream_,updater);
+    SignaturesPlaceholderUpdater updater(index_);
 
-    fsw.walk();
+    replay_index(index_,stream_,updater);
     if(!updater.found)
       throw Error("image is missing file: signatures");
   }
 
   static
   void
-  preflight_signing_image(TDO::FileStream &stream_,
-                          const bool       include_banner_romtag_,
-                          const bool       include_billstuff_romtag_)
+  preflight_signing_image(TDO::FileStream    &stream_,
+                          const TDO::FSIndex &index_,
+                          const bool          include_banner_romtag_,
+                          const bool          include_billstuff_romtag_)
   {
     SigningPreflight preflight(include_banner_romtag_);
-    TDO::FSWalker fsw(stream_,preflight);
 
     if(!stream_.has_romtags())
       throw Error("image does not contain ROMTags");
 
-    fsw.walk();
+    // The index is captured without the existing ROMTag size overrides.
+    // Apply them here so a tag that overruns its record's allocation
+    // still rejects the image before anything is written. Records the
+    // index skipped for their names are checked too, as the walk used
+    // to apply overrides before looking at the name.
+    const TDO::FSWalker::ROMTagIndex existing_romtags(stream_.romtags());
+    for(const auto &entry : index_)
+      {
+        TDO::DirectoryRecord record = entry.record;
+
+        Error err = existing_romtags.apply(record);
+        if(err)
+          throw err;
+      }
+    for(TDO::DirectoryRecord record : index_.skipped())
+      {
+        Error err = existing_romtags.apply(record);
+        if(err)
+          throw err;
+      }
+
+    replay_index(index_,stream_,preflight);
 
     if(!preflight.found_rom_tags)
       throw Error("image is missing file: rom_tags");
@@ -1219,6 +1275,7 @@ namespace
   static
   void
   generate_and_write_romtags(TDO::FileStream &stream_,
+                             TDO::FSIndex    &index_,
                              const bool       include_banner_romtag_,
                              const bool       include_billstuff_romtag_,
                              const TDO::ROMTagVec &source_romtags_)
@@ -1227,12 +1284,13 @@ namespace
 
     _vprint("  - Generate and write ROM Tags\n");
     romtags = generate_romtags_for_image(stream_,
+                                         index_,
                                          include_banner_romtag_,
                                          include_billstuff_romtag_,
                                          true,
                                          source_romtags_);
     write_romtags(stream_,romtags);
-    update_romtags_file(stream_,romtags.size() * sizeof(TDO::ROMTag));
+    update_romtags_file(stream_,index_,romtags.size() * sizeof(TDO::ROMTag));
   }
 
   static
@@ -1244,7 +1302,6 @@ namespace
   {
     md5_digest_t digest;
     rsa512_sig_t sig;
-    std::vector<char> data;
     std::optional<TDO::ROMTag> romtag;
 
     romtag = stream_.romtag(romtag_type_);
@@ -1258,16 +1315,14 @@ namespace
                                                       romtag->size,
                                                       label_);
 
-    stream_.read_data_bytes_from_block(data,
-                                       first_block,
-                                       romtag->size);
-
-    data.resize(romtag->size - RSA512_SIG_SIZE);
     // CD-ROM ROMTag asset checks (cdromdipir.c:ReadOsComponent)
     // hash the raw payload up to the trailing signature. RSACheck's
     // _3DO_SignatureLen zeroing applies to AIF task/driver checks, not
     // these ROMTag signatures.
-    md5_calc(data.data(),data.size(),digest);
+    TDO::md5_data_bytes(stream_,
+                        first_block * TDO::BLOCK_SIZE,
+                        romtag->size - RSA512_SIG_SIZE,
+                        digest);
     tdo_rsa_sign(key_,digest,sig);
 
     _vprint("  - Signing {}\n"
@@ -1313,7 +1368,7 @@ namespace
     const u64 outer_sig_offset = romtag->size - RSA512_SIG_SIZE;
     stream_.read_data_bytes_from_block(data,
                                        first_block,
-                                       romtag->size);
+                                       post_cheeze_sig_offset);
 
     TDO::decrypt_boot_code_range(data.data(),post_cheeze_sig_offset);
     md5_calc(data.data(),post_cheeze_sig_offset,digest);
@@ -1334,11 +1389,12 @@ namespace
                            post_cheeze_sig_offset);
     stream_.write(encrypted_sig.data(),encrypted_sig.size());
 
-    data.clear();
-    stream_.read_data_bytes_from_block(data,
-                                       first_block,
-                                       outer_sig_offset);
-    md5_calc(data.data(),data.size(),digest);
+    // Everything before the slot just written is unchanged so with
+    // digests attached only its last block is read again.
+    TDO::md5_data_bytes(stream_,
+                        first_block * TDO::BLOCK_SIZE,
+                        outer_sig_offset,
+                        digest);
     tdo_rsa_sign(TDO_KEY_3DO,digest,sig);
 
     _vprint("  - Signing encrypted boot_code\n"
@@ -1363,38 +1419,47 @@ namespace
 
   static
   void
-  inspect_aif_files(TDO::FileStream &stream_)
+  inspect_aif_files(TDO::FileStream    &stream_,
+                    const TDO::FSIndex &index_)
   {
     PresentAIFSignatureInspector inspector;
-    TDO::FSWalker fsw(stream_,inspector,false);
 
-    fsw.walk();
+    replay_index(index_,stream_,inspector);
   }
 
   static
   void
   sign_disclabel_romtags_bootcode(TDO::FileStream &stream_)
   {
+    md5_ctx_t ctx;
     md5_digest_t digest;
     rsa512_sig_t signature;
-    std::vector<char> data;
     std::optional<TDO::ROMTag> romtag;
 
     romtag = stream_.romtag(RSA_NEWKNEWNEWGNUBOOT);
     if(!romtag)
       throw Error("boot_code ROM tag not found");
 
-    stream_.read_data_bytes_from_block(data,
-                                       stream_.disc_label_block(),
-                                       stream_.disc_label_size_in_bytes());
-    stream_.read_data_bytes_from_block(data,
-                                       stream_.romtags_block(),
-                                       stream_.romtags_size_in_bytes());
-    stream_.read_data_bytes_from_block(data,
-                                       safe_romtag_first_data_block(stream_,*romtag,"boot_code"),
-                                       romtag->size);
-
-    md5_calc(data.data(),data.size(),digest);
+    md5_init(&ctx);
+    {
+      const TDO::DataView data =
+        stream_.data_bytes_view_from_block(stream_.disc_label_block(),
+                                           stream_.disc_label_size_in_bytes());
+      md5_update(&ctx,data.data(),data.size());
+    }
+    {
+      const TDO::DataView data =
+        stream_.data_bytes_view_from_block(stream_.romtags_block(),
+                                           stream_.romtags_size_in_bytes());
+      md5_update(&ctx,data.data(),data.size());
+    }
+    {
+      const TDO::DataView data =
+        stream_.data_bytes_view_from_block(safe_romtag_first_data_block(stream_,*romtag,"boot_code"),
+                                           romtag->size);
+      md5_update(&ctx,data.data(),data.size());
+    }
+    md5_finalize(&ctx,digest);
     tdo_rsa_sign(TDO_KEY_APP,digest,signature);
 
     _vprint("  - Signing DiscLabel + ROMTags + BootCode with APP key\n"
@@ -1409,12 +1474,44 @@ namespace
   }
 }
 
+u64
+TDO::signed_romtag_payload_head_size(const u32 romtag_type_)
+{
+  switch(romtag_type_)
+    {
+    case RSA_APPSPLASH:
+      return sizeof(APP_SPLASH_PATTERN);
+    case RSA_OS:
+    case RSA_MISCCODE:
+    case RSA_OLD_MISCCODE:
+      return (COMPONENT_SIZE_OFFSET + sizeof(u32));
+    }
+
+  return 0;
+}
+
 TDO::SignedROMTagPayloadLayout
 TDO::inspect_signed_romtag_payload(const u32                romtag_type_,
                                    const std::vector<char> &data_,
                                    const u32                logical_size_hint_,
                                    const u32                authoritative_size_hint_,
                                    const u32                existing_size_hint_)
+{
+  return TDO::inspect_signed_romtag_payload_head(romtag_type_,
+                                                 data_,
+                                                 data_.size(),
+                                                 logical_size_hint_,
+                                                 authoritative_size_hint_,
+                                                 existing_size_hint_);
+}
+
+TDO::SignedROMTagPayloadLayout
+TDO::inspect_signed_romtag_payload_head(const u32                romtag_type_,
+                                        const std::vector<char> &data_,
+                                        const u64                data_size_,
+                                        const u32                logical_size_hint_,
+                                        const u32                authoritative_size_hint_,
+                                        const u32                existing_size_hint_)
 {
   u64 payload_size;
   u64 signed_size;
@@ -1428,7 +1525,7 @@ TDO::inspect_signed_romtag_payload(const u32                romtag_type_,
     {
     case RSA_APPSPLASH:
       {
-        if(data_.size() < TDO::APP_SPLASH_NTSC_PAYLOAD_SIZE)
+        if(data_size_ < TDO::APP_SPLASH_NTSC_PAYLOAD_SIZE)
           throw Error("BannerScreen is smaller than the standard 153624-byte payload");
         if((static_cast<u8>(data_[0]) != 1) ||
            (std::memcmp(data_.data() + 1,
@@ -1462,7 +1559,7 @@ TDO::inspect_signed_romtag_payload(const u32                romtag_type_,
       // makeboot stores the unsigned component extent in the big-endian word
       // at +4. Portfolio's ReadOsComponent hashes rt_Size - 64 bytes, then
       // reads the signature immediately after that declared payload.
-      if(data_.size() < (COMPONENT_SIZE_OFFSET + sizeof(u32)))
+      if(data_size_ < (COMPONENT_SIZE_OFFSET + sizeof(u32)))
         throw Error("system component is too small to contain its size header");
       payload_size = read_u32_be(data_,COMPONENT_SIZE_OFFSET);
       if(payload_size < (COMPONENT_SIZE_OFFSET + sizeof(u32)))
@@ -1474,6 +1571,9 @@ TDO::inspect_signed_romtag_payload(const u32                romtag_type_,
         std::vector<char> decrypted(data_);
         std::optional<u64> derived_size;
 
+        if(data_.size() != data_size_)
+          throw Error("boot_code layout inspection needs the whole payload");
+
         signature_size = RSA512_SIG_SIZE * 2;
         decrypt_boot_code_data(decrypted);
         derived_size = boot_code_signed_size_from_decrypted(decrypted);
@@ -1593,7 +1693,7 @@ TDO::inspect_signed_romtag_payload(const u32                romtag_type_,
 
   if(signed_size == 0)
     signed_size = payload_size + signature_size;
-  if((payload_size > data_.size()) ||
+  if((payload_size > data_size_) ||
      (payload_size > std::numeric_limits<u32>::max()) ||
      (signed_size > std::numeric_limits<u32>::max()))
     throw Error("signed ROMTag payload size is outside the available data");
@@ -1613,6 +1713,7 @@ TDO::recreate_layout_special_files(const std::filesystem::path &filepath_,
   SpecialFileCapacity capacity;
   TDO::ROMTagVec romtags;
   TDO::FileStream stream;
+  TDO::FSIndex index;
 
   g_verbose = verbose_;
   stream.open(filepath_,std::ios::in|std::ios::out);
@@ -1621,14 +1722,12 @@ TDO::recreate_layout_special_files(const std::filesystem::path &filepath_,
   _vprint("{}:\n",filepath_);
   _vprint("  - Recreate layout special files\n");
 
-  {
-    TDO::FSWalker fsw(stream,capacity,false);
-
-    fsw.walk();
-  }
+  index.build(stream);
+  replay_index(index,stream,capacity);
   update_disclabel(stream);
-  reset_signatures_placeholder(stream);
+  reset_signatures_placeholder(stream,index);
   romtags = generate_romtags_for_image(stream,
+                                       index,
                                        include_banner_romtag_,
                                        include_billstuff_romtag_,
                                        sign_payloads_,
@@ -1639,12 +1738,12 @@ TDO::recreate_layout_special_files(const std::filesystem::path &filepath_,
 
   _vprint("  - Write layout ROM Tags\n");
   write_romtags(stream,romtags);
-  update_romtags_file(stream,romtags.size() * sizeof(TDO::ROMTag));
+  update_romtags_file(stream,index,romtags.size() * sizeof(TDO::ROMTag));
 
   if(sign_payloads_)
     {
       sign_system_payloads(stream);
-      inspect_aif_files(stream);
+      inspect_aif_files(stream,index);
       sign_appsplash(stream);
 
       // System signing changes the full payload hashes used by the ROMTag
@@ -1652,6 +1751,7 @@ TDO::recreate_layout_special_files(const std::filesystem::path &filepath_,
       // payloads that normalize to a known retail form receive the matching
       // version/revision before the cross-app signature is calculated.
       generate_and_write_romtags(stream,
+                                 index,
                                  include_banner_romtag_,
                                  include_billstuff_romtag_,
                                  source_romtags_);
@@ -1680,6 +1780,44 @@ TDO::mark_disc_image(const std::filesystem::path &filepath_,
   stream.close();
 }
 
+static
+void
+sign_disc_stream(TDO::FileStream      &stream_,
+                 const bool            mark_,
+                 const bool            preflight_,
+                 const bool            include_banner_romtag_,
+                 const bool            include_billstuff_romtag_,
+                 const TDO::ROMTagVec &source_romtags_)
+{
+  TDO::FSIndex index;
+
+  index.build(stream_);
+  if(preflight_)
+    preflight_signing_image(stream_,
+                            index,
+                            include_banner_romtag_,
+                            include_billstuff_romtag_);
+
+  update_disclabel(stream_);
+  if(mark_)
+    add_3dt_mark(stream_,"signed");
+  reset_signatures_placeholder(stream_,index);
+  generate_and_write_romtags(stream_,
+                             index,
+                             include_banner_romtag_,
+                             include_billstuff_romtag_,
+                             source_romtags_);
+  sign_system_payloads(stream_);
+  inspect_aif_files(stream_,index);
+  sign_appsplash(stream_);
+  generate_and_write_romtags(stream_,
+                             index,
+                             include_banner_romtag_,
+                             include_billstuff_romtag_,
+                             source_romtags_);
+  sign_disclabel_romtags_bootcode(stream_);
+}
+
 void
 TDO::sign_disc_image(const std::filesystem::path &filepath_,
                      const bool                   mark_,
@@ -1687,37 +1825,53 @@ TDO::sign_disc_image(const std::filesystem::path &filepath_,
                      const bool                   include_banner_romtag_,
                      const bool                   include_billstuff_romtag_,
                      const TDO::ROMTagVec        &source_romtags_,
-                     const bool                   verbose_)
+                     const bool                   verbose_,
+                     TDO::PayloadDigests         *digests_)
 {
   TDO::FileStream stream;
 
   g_verbose = verbose_;
   stream.open(filepath_,std::ios::in|std::ios::out);
   require_iso2048_image(stream);
+  stream.set_payload_digests(digests_);
 
   _vprint("{}:\n",filepath_);
 
-  if(preflight_)
-    preflight_signing_image(stream,
-                            include_banner_romtag_,
-                            include_billstuff_romtag_);
+  sign_disc_stream(stream,
+                   mark_,
+                   preflight_,
+                   include_banner_romtag_,
+                   include_billstuff_romtag_,
+                   source_romtags_);
 
-  update_disclabel(stream);
-  if(mark_)
-    add_3dt_mark(stream,"signed");
-  reset_signatures_placeholder(stream);
-  generate_and_write_romtags(stream,
-                             include_banner_romtag_,
-                             include_billstuff_romtag_,
-                             source_romtags_);
-  sign_system_payloads(stream);
-  inspect_aif_files(stream);
-  sign_appsplash(stream);
-  generate_and_write_romtags(stream,
-                             include_banner_romtag_,
-                             include_billstuff_romtag_,
-                             source_romtags_);
-  sign_disclabel_romtags_bootcode(stream);
+  stream.close();
+}
+
+void
+TDO::sign_disc_image(const std::filesystem::path &input_,
+                     const std::filesystem::path &output_,
+                     const bool                   mark_,
+                     const bool                   preflight_,
+                     const bool                   include_banner_romtag_,
+                     const bool                   include_billstuff_romtag_,
+                     const TDO::ROMTagVec        &source_romtags_,
+                     const bool                   verbose_)
+{
+  TDO::FileStream stream;
+
+  g_verbose = verbose_;
+  stream.open_overlay(input_);
+  require_iso2048_image(stream);
+
+  _vprint("{}:\n",output_);
+
+  sign_disc_stream(stream,
+                   mark_,
+                   preflight_,
+                   include_banner_romtag_,
+                   include_billstuff_romtag_,
+                   source_romtags_);
 
+  stream.save_overlay(output_);
   stream.close();
 }
@@ -27,6 +27,16 @@ namespace TDO
                                                           u32                      logical_size_hint = 0,
                                                           u32                      authoritative_size_hint = 0,
                                                           u32                      existing_size_hint = 0);
+  // Same as above when data holds only the first bytes of a payload
+  // data_size bytes long. signed_romtag_payload_head_size() says how
+  // many are looked at; 0 means the whole payload is needed.
+  u64 signed_romtag_payload_head_size(u32 romtag_type);
+  SignedROMTagPayloadLayout inspect_signed_romtag_payload_head(u32                      romtag_type,
+                                                               const std::vector<char> &data,
+                                                               u64                      data_size,
+                                                               u32                      logical_size_hint,
+                                                               u32                      authoritative_size_hint,
+                                                               u32                      existing_size_hint);
 
   void recreate_layout_special_files(const std::filesystem::path &filepath,
                                       bool                         sign_payloads = false,
@@ -38,11 +48,27 @@ namespace TDO
   void mark_disc_image(const std::filesystem::path &filepath,
                        const std::string           &action,
                        bool                         verbose = true);
+  class PayloadDigests;
+
+  // digests, when given, is attached to the image so payloads it
+  // covers are hashed from the saved state. It is left describing the
+  // signed image.
   void sign_disc_image(const std::filesystem::path &filepath,
                         bool                         mark = false,
                         bool                         preflight = true,
                         bool                         banner_romtag = true,
                         bool                         billstuff_romtag = false,
                         const TDO::ROMTagVec        &source_romtags = {},
-                        bool                         verbose = true);
+                        bool                         verbose = true,
+                        TDO::PayloadDigests         *digests = nullptr);
+  // Same as above but input is only read. Every change is computed in
+  // memory and the signed image is written to output in one pass.
+  void sign_disc_image(const std::filesystem::path &input,
+                       const std::filesystem::path &output,
+                       bool                         mark = false,
+                       bool                         preflight = true,
+                       bool                         banner_romtag = true,
+                       bool                         billstuff_romtag = false,
+                       const TDO::ROMTagVec        &source_romtags = {},
+                       bool                         verbose = true);
 }
@@ -26,21 +26,323 @@
 
 #include "fmt.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <cctype>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 
 namespace fs = std::filesystem;
 
+namespace
+{
+  constexpr std::uint64_t EXTRACT_BUF_SIZE = (64 * 1024);
+
+  void
+  extract_file(TDO::DevStream             &stream_,
+               const fs::path             &fullpath_,
+               const TDO::DirectoryRecord &record_,
+               std::vector<char>          &buf_)
+  {
+    std::ofstream os;
+    std::uint64_t bytes_left;
+    std::uint64_t byte_pos;
+
+    bytes_left = record_.byte_count;
+    if((bytes_left > 0) && record_.avatar_list.empty())
+      throw Error("file record has byte_count > 0 but no avatars: " +
+                  fullpath_.string());
+
+    os.open(fullpath_,std::ios::binary|std::ios::trunc);
+    if(!os.is_open())
+      throw Error("failed to open output file: " + fullpath_.string());
+
+    if(bytes_left > 0)
+      {
+        byte_pos = static_cast<std::uint64_t>(record_.avatar_list[0]) *
+                   stream_.device_block_data_size();
+        buf_.resize(std::min<std::uint64_t>(bytes_left,EXTRACT_BUF_SIZE));
+      }
+    else
+      {
+        byte_pos = 0;
+      }
+
+    while(bytes_left > 0)
+      {
+        const std::uint64_t n = std::min<std::uint64_t>(bytes_left,buf_.size());
+        stream_.pread_data_bytes(buf_.data(),
+                                 static_cast<s64>(byte_pos),
+                                 static_cast<s64>(n));
+        os.write(buf_.data(),n);
+        if(!os)
+          throw Error("failed to write output file: " + fullpath_.string());
+        byte_pos   += n;
+        bytes_left -= n;
+      }
+
+    os.close();
+    if(os.fail())
+      throw Error("failed to close output file: " + fullpath_.string());
+  }
+
+  // One record visited by the walk, kept until Callback::after has
+  // been called for it.
+  struct ExtractJob
+  {
+    fs::path             path;
+    fs::path             fullpath;
+    TDO::DirectoryRecord record;
+    int                  err = 0;
+    std::string          message;
+    bool                 extract = false;
+    bool                 done = false;
+    std::uint64_t        charge = 0;
+    std::exception_ptr   exception;
+  };
+
+  // Reads the image front to back through a window of at most
+  // max_memory data bytes so that files extracted in on-disc order
+  // cost a few large sequential reads rather than one seek each.
+  class SequentialReader
+  {
+  public:
+    SequentialReader(TDO::DevStream      &stream_,
+                     const std::uint64_t  max_memory_)
+      : _stream(stream_),
+        _max_memory(max_memory_),
+        _pos(0),
+        _len(0)
+    {
+    }
+
+  public:
+    // Copies bytes_ data bytes starting at pos_ to os_. horizon_ is
+    // the furthest data byte any remaining file needs; refills never
+    // read past it.
+    void
+    copy(std::ostream        &os_,
+         s64                  pos_,
+         std::uint64_t        bytes_,
+         const s64            horizon_)
+    {
+      while(bytes_ > 0)
+        {
+          std::uint64_t n;
+
+          if((pos_ < _pos) || (pos_ >= (_pos + _len)))
+            fill(pos_,horizon_);
+
+          n = std::min<std::uint64_t>(bytes_,(_pos + _len) - pos_);
+          os_.write(&_buf[pos_ - _pos],n);
+          if(!os_)
+            return;
+
+          pos_   += n;
+          bytes_ -= n;
+        }
+    }
+
+  private:
+    void
+    fill(const s64 pos_,
+         const s64 horizon_)
+    {
+      _len = std::min<s64>(_max_memory,horizon_ - pos_);
+      if(_buf.size() < static_cast<std::size_t>(_len))
+        _buf.resize(_len);
+
+      _pos = pos_;
+      _stream.pread_data_bytes(_buf.data(),_pos,_len);
+    }
+
+  private:
+    TDO::DevStream      &_stream;
+    const std::uint64_t  _max_memory;
+    std::vector<char>    _buf;
+    s64                  _pos;
+    s64                  _len;
+  };
+
+  // Extracts queued files on worker threads while the walk continues.
+  // Every record the walk visits is submitted, extracted or not, so
+  // finished jobs can be handed back in walk order on the submitting
+  // thread. Each worker's read buffer is charged against the cap up
+  // front; only as many workers are started as have buffers that fit.
+  // A queued job holds just its record and paths, which are charged
+  // from submission until it is handed back. Submission blocks while
+  // the total is over the cap.
+  class ExtractPool
+  {
+  public:
+    ExtractPool(TDO::DevStream      &stream_,
+                const std::uint32_t  jobs_,
+                const std::uint64_t  max_memory_)
+      : _stream(stream_),
+        _max_memory(max_memory_),
+        _charged(0),
+        _failed(false),
+        _stop(false)
+    {
+      std::uint64_t workers;
+
+      workers = std::clamp<std::uint64_t>(max_memory_ / EXTRACT_BUF_SIZE,1,jobs_);
+      _charged = (workers * EXTRACT_BUF_SIZE);
+      for(std::uint64_t i = 0; i < workers; i++)
+        _workers.emplace_back([this]() { work(); });
+    }
+
+    ~ExtractPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _cv.notify_all();
+
+      for(auto &worker : _workers)
+        worker.join();
+    }
+
+  public:
+    template<typename EmitFunc>
+    void
+    submit(ExtractJob  &&job_,
+           EmitFunc    &&emit_)
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      job_.charge = (sizeof(ExtractJob) +
+                     job_.path.native().size() +
+                     job_.fullpath.native().size() +
+                     (job_.record.avatar_list.size() * sizeof(std::uint32_t)));
+
+      for(;;)
+        {
+          emit_done(lock,emit_);
+          if(_jobs.empty() || ((_charged + job_.charge) <= _max_memory))
+            break;
+          _cv.wait(lock);
+        }
+
+      _charged += job_.charge;
+      _jobs.emplace_back(std::move(job_));
+      if(_jobs.back().extract)
+        {
+          _todo.push_back(&_jobs.back());
+          _cv.notify_all();
+        }
+
+      emit_done(lock,emit_);
+    }
+
+    template<typename EmitFunc>
+    void
+    drain(EmitFunc &&emit_)
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      for(;;)
+        {
+          emit_done(lock,emit_);
+          if(_jobs.empty())
+            break;
+          _cv.wait(lock);
+        }
+    }
+
+  private:
+    template<typename EmitFunc>
+    void
+    emit_done(std::unique_lock<std::mutex> &lock_,
+              EmitFunc                     &emit_)
+    {
+      while(!_jobs.empty() && _jobs.front().done)
+        {
+          ExtractJob job = std::move(_jobs.front());
+
+          _jobs.pop_front();
+          _charged -= job.charge;
+
+          lock_.unlock();
+          if(job.exception)
+            std::rethrow_exception(job.exception);
+          emit_(job);
+          lock_.lock();
+        }
+    }
+
+    void
+    work()
+    {
+      std::vector<char> buf;
+      std::unique_lock<std::mutex> lock(_mutex);
+
+      for(;;)
+        {
+          ExtractJob *job;
+
+          _cv.wait(lock,[this]() { return (_stop || !_todo.empty()); });
+          if(_stop)
+            return;
+
+          job = _todo.front();
+          _todo.pop_front();
+
+          // Once a job fails the jobs behind it are never handed back
+          // so there is no point writing them.
+          if(!_failed)
+            {
+              lock.unlock();
+              try
+                {
+                  extract_file(_stream,job->fullpath,job->record,buf);
+                }
+              catch(...)
+                {
+                  job->exception = std::current_exception();
+                }
+              lock.lock();
+            }
+
+          if(job->exception)
+            _failed = true;
+          job->done = true;
+          _cv.notify_all();
+        }
+    }
+
+  private:
+    TDO::DevStream           &_stream;
+    const std::uint64_t       _max_memory;
+    std::mutex                _mutex;
+    std::condition_variable   _cv;
+    std::deque<ExtractJob>    _jobs;
+    std::deque<ExtractJob*>   _todo;
+    std::vector<std::thread>  _workers;
+    std::uint64_t             _charged;
+    bool                      _failed;
+    bool                      _stop;
+  };
+}
+
 class TDO::DiscUnpacker::Impl final : public TDO::FSWalker::Callbacks
 {
 public:
   Impl(std::iostream               &ios_,
        TDO::DiscUnpacker::Callback &cb_)
     : _cb(cb_),
+      _ios(ios_),
       _walker(ios_,*this),
-      _dstpath()
+      _dstpath(),
+      _jobs(1),
+      _max_memory(0),
+      _disc_order(false)
   {
   }
 
@@ -49,11 +351,168 @@ public:
   }
 
 public:
+  void
+  set_jobs(const std::uint32_t jobs_,
+           const std::uint64_t max_memory_)
+  {
+    _jobs       = std::max<std::uint32_t>(jobs_,1);
+    _max_memory = max_memory_;
+  }
+
+  void
+  set_disc_order(const bool          disc_order_,
+                 const std::uint64_t max_memory_)
+  {
+    _disc_order = disc_order_;
+    _max_memory = max_memory_;
+  }
+
   void
   unpack(const fs::path &dstpath_)
   {
     _dstpath = dstpath_;
-    _walker.walk();
+    _deferred.clear();
+
+    // Workers and the disc order pass read through their own
+    // DevStream so they never depend on the lifetime of the walker's.
+    // Images are only read in parallel when pread_data_bytes() uses a
+    // mapping or descriptor: its stream fallback would race the
+    // walker's own reads of the shared iostream.
+    if(_disc_order || (_jobs > 1))
+      {
+        _pstream = std::make_unique<TDO::DevStream>(_ios);
+        _pstream->setup();
+        if(!_disc_order && _pstream->has_concurrent_pread())
+          _pool = std::make_unique<ExtractPool>(*_pstream,_jobs,_max_memory);
+        else if(!_disc_order)
+          fmt::print(stderr,
+                     "3dt: warning: image does not support positional reads, "
+                     "ignoring --jobs={} and extracting serially\n",
+                     _jobs);
+      }
+
+    try
+      {
+        _walker.walk();
+      }
+    catch(...)
+      {
+        // Write what the walk collected before it failed so disc order
+        // leaves the same files behind as the other modes. The walk's
+        // error is the one reported.
+        if(_disc_order)
+          {
+            try
+              {
+                extract_in_disc_order();
+              }
+            catch(...)
+              {
+              }
+          }
+        _pool.reset();
+        _pstream.reset();
+        _deferred.clear();
+        throw;
+      }
+
+    _pool.reset();
+    _pstream.reset();
+    _deferred.clear();
+  }
+
+  // Extracts the files collected by the walk sorted by their first
+  // data byte then reports every record in walk order. If a file
+  // fails the records written before the first unwritten one in walk
+  // order are still reported.
+  void
+  extract_in_disc_order()
+  {
+    std::vector<std::size_t> order;
+    std::vector<s64> starts;
+    std::vector<s64> horizons;
+    std::uint64_t window;
+    s64 lo;
+    s64 hi;
+
+    starts.resize(_deferred.size(),0);
+    for(std::size_t i = 0; i < _deferred.size(); i++)
+      {
+        const ExtractJob &job = _deferred[i];
+
+        if(!job.extract)
+          continue;
+        if(job.record.byte_count > 0)
+          starts[i] = (static_cast<s64>(job.record.avatar_list[0]) *
+                       _pstream->device_block_data_size());
+        order.push_back(i);
+      }
+
+    std::stable_sort(order.begin(),
+                     order.end(),
+                     [&](const std::size_t a_,
+                         const std::size_t b_)
+                     {
+                       return (starts[a_] < starts[b_]);
+                     });
+
+    lo = 0;
+    hi = 0;
+    horizons.resize(order.size(),0);
+    for(std::size_t i = order.size(); i-- > 0;)
+      {
+        const ExtractJob &job = _deferred[order[i]];
+        const s64 end = starts[order[i]] + job.record.byte_count;
+
+        hi = std::max(hi,end);
+        horizons[i] = hi;
+        if(job.record.byte_count > 0)
+          lo = starts[order[i]];
+      }
+
+    window = std::min<std::uint64_t>(_max_memory,std::max<s64>(hi - lo,1));
+    SequentialReader reader(*_pstream,window);
+
+    try
+      {
+        for(std::size_t i = 0; i < order.size(); i++)
+          {
+            ExtractJob &job = _deferred[order[i]];
+            std::ofstream os;
+
+            os.open(job.fullpath,std::ios::binary|std::ios::trunc);
+            if(!os.is_open())
+              throw Error("failed to open output file: " + job.fullpath.string());
+
+            reader.copy(os,starts[order[i]],job.record.byte_count,horizons[i]);
+            if(!os)
+              throw Error("failed to write output file: " + job.fullpath.string());
+
+            os.close();
+            if(os.fail())
+              throw Error("failed to close output file: " + job.fullpath.string());
+            job.done = true;
+          }
+      }
+    catch(...)
+      {
+        emit_deferred();
+        throw;
+      }
+
+    emit_deferred();
+  }
+
+  void
+  emit_deferred()
+  {
+    for(const auto &job : _deferred)
+      {
+        if(!job.done)
+          break;
+        emit(job);
+      }
+    _deferred.clear();
   }
 
 public:
@@ -66,9 +525,34 @@ public:
   void
   end()
   {
+    if(_pool)
+      _pool->drain([this](const ExtractJob &done_) { emit(done_); });
+    if(_disc_order)
+      extract_in_disc_order();
     _cb.end();
   }
 
+  void
+  emit(const ExtractJob &job_)
+  {
+    _cb.after(job_.path,job_.record,job_.err);
+    if(!job_.message.empty())
+      fmt::print(stderr,"3dt: {} - {}\n",job_.message,job_.path.generic_string());
+  }
+
+  void
+  submit(ExtractJob &&job_)
+  {
+    if(_disc_order)
+      {
+        _deferred.emplace_back(std::move(job_));
+        return;
+      }
+
+    _pool->submit(std::move(job_),
+                  [this](const ExtractJob &done_) { emit(done_); });
+  }
+
 
 public:
   void
@@ -125,53 +609,30 @@ public:
 
     _cb.before(path_,record_,dr_file_pos_,stream_);
     if(record_.is_directory())
-      {
-        fs::create_directories(fullpath);
-      }
-    else
-      {
-        std::ofstream os;
-        std::uint64_t bytes_left;
-        std::uint64_t byte_pos;
-        std::vector<char> buf;
-
-        bytes_left = record_.byte_count;
-        if((bytes_left > 0) && record_.avatar_list.empty())
-          throw Error("file record has byte_count > 0 but no avatars: " +
-                      fullpath.string());
-
-        os.open(fullpath,std::ios::binary|std::ios::trunc);
-        if(!os.is_open())
-          throw Error("failed to open output file: " + fullpath.string());
+      fs::create_directories(fullpath);
 
-        if(bytes_left > 0)
-          {
-            byte_pos = static_cast<std::uint64_t>(record_.avatar_list[0]) *
-                       stream_.device_block_data_size();
-            buf.resize(std::min<std::uint64_t>(bytes_left,64*1024));
-          }
-        else
-          {
-            byte_pos = 0;
-          }
+    if(_disc_order &&
+       !record_.is_directory() &&
+       (record_.byte_count > 0) &&
+       record_.avatar_list.empty())
+      throw Error("file record has byte_count > 0 but no avatars: " +
+                  fullpath.string());
 
-        while(bytes_left > 0)
-          {
-            const std::uint64_t n = std::min<std::uint64_t>(bytes_left,buf.size());
-            stream_.read_data_bytes(buf.data(),
-                                    static_cast<s64>(byte_pos),
-                                    static_cast<s64>(n));
-            os.write(buf.data(),n);
-            if(!os)
-              throw Error("failed to write output file: " + fullpath.string());
-            byte_pos   += n;
-            bytes_left -= n;
-          }
-
-        os.close();
-        if(os.fail())
-          throw Error("failed to close output file: " + fullpath.string());
+    if(_pool || _disc_order)
+      {
+        ExtractJob job;
+
+        job.path     = path_;
+        job.fullpath = std::move(fullpath);
+        job.record   = record_;
+        job.extract  = !record_.is_directory();
+        job.done     = !job.extract;
+        submit(std::move(job));
+        return;
       }
+
+    if(!record_.is_directory())
+      extract_file(stream_,fullpath,record_,_buf);
     _cb.after(path_,record_,0);
   }
 
@@ -186,6 +647,19 @@ public:
     const fs::path path = TDO::display_path(parent_,filename_);
 
     _cb.before(path,record_,dr_file_pos_,stream_);
+    if(_pool || _disc_order)
+      {
+        ExtractJob job;
+
+        job.path    = path;
+        job.record  = record_;
+        job.err     = 1;
+        job.message = err_.str;
+        job.done    = true;
+        submit(std::move(job));
+        return Error();
+      }
+
     _cb.after(path,record_,1);
     fmt::print(stderr,"3dt: {} - {}\n",err_.str,path.generic_string());
 
@@ -194,10 +668,18 @@ public:
 
 private:
   TDO::DiscUnpacker::Callback &_cb;
+  std::iostream               &_ios;
   TDO::FSWalker                _walker;
 
 private:
-  fs::path _dstpath;
+  fs::path                        _dstpath;
+  std::vector<char>               _buf;
+  std::uint32_t                   _jobs;
+  std::uint64_t                   _max_memory;
+  bool                            _disc_order;
+  std::vector<ExtractJob>         _deferred;
+  std::unique_ptr<TDO::DevStream> _pstream;
+  std::unique_ptr<ExtractPool>    _pool;
 };
 
 namespace TDO
@@ -212,6 +694,20 @@ namespace TDO
   {
   }
 
+  void
+  DiscUnpacker::set_disc_order(const bool          disc_order_,
+                               const std::uint64_t max_memory_)
+  {
+    _impl->set_disc_order(disc_order_,max_memory_);
+  }
+
+  void
+  DiscUnpacker::set_jobs(const std::uint32_t jobs_,
+                         const std::uint64_t max_memory_)
+  {
+    _impl->set_jobs(jobs_,max_memory_);
+  }
+
   void
   DiscUnpacker::unpack(const fs::path &dstpath_)
   {
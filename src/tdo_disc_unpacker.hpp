@@ -21,6 +21,7 @@
 #include "error.hpp"
 #include "tdo_fs_walker.hpp"
 
+#include <cstdint>
 #include <filesystem>
 #include <istream>
 #include <memory>
@@ -59,6 +60,25 @@ namespace TDO
                  Callback      &cb);
     ~DiscUnpacker();
 
+  public:
+    // Extract up to jobs files at once on worker threads while the
+    // walk continues. max_memory caps the workers' read buffers plus
+    // the records queued but not yet reported; fewer workers are used
+    // if their buffers alone would not fit. Callback::after is still
+    // called in walk order on the calling thread. Images that are
+    // neither memory mapped nor a file opened read-only, such as
+    // pipes, are always extracted serially.
+    void set_jobs(const std::uint32_t jobs,
+                  const std::uint64_t max_memory);
+
+    // Collect every record first then extract the files sorted by
+    // their first block, reading the image front to back through a
+    // window of at most max_memory bytes. Callback::after is called
+    // for all records in walk order once extraction is done. Takes
+    // precedence over set_jobs().
+    void set_disc_order(const bool          disc_order,
+                        const std::uint64_t max_memory);
+
   public:
     void unpack(const std::filesystem::path &dstpath);
 
@@ -46,6 +46,26 @@ namespace TDO
     _filepath = filepath_;
   }
 
+  void
+  FileStream::open_overlay(const std::filesystem::path &filepath_)
+  {
+    close();
+
+    _fs.open_overlay(filepath_);
+    if(!_fs)
+      throw Error("failed to open");
+
+    setup();
+
+    _filepath = filepath_;
+  }
+
+  void
+  FileStream::save_overlay(const std::filesystem::path &filepath_)
+  {
+    _fs.save_overlay(filepath_);
+  }
+
   const
   std::filesystem::path&
   FileStream::filepath() const
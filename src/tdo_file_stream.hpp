@@ -19,8 +19,8 @@
 #pragma once
 
 #include "tdo_dev_stream.hpp"
+#include "tdo_image_fstream.hpp"
 
-#include <fstream>
 #include <filesystem>
 
 
@@ -37,6 +37,12 @@ namespace TDO
               const std::ios::openmode     mode = std::ios::in);
     void  close();
 
+  public:
+    // Open read-only with writes held in memory, see OverlayFileBuf.
+    // save_overlay() writes the modified image to a new file.
+    void open_overlay(const std::filesystem::path &filepath);
+    void save_overlay(const std::filesystem::path &filepath);
+
   public:
     const std::filesystem::path& filepath() const;
 
@@ -45,6 +51,6 @@ namespace TDO
 
   private:
     std::filesystem::path _filepath;
-    std::fstream          _fs;
+    ImageFStream          _fs;
   };
 }
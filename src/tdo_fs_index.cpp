@@ -0,0 +1,110 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "tdo_fs_index.hpp"
+
+#include "error.hpp"
+#include "nonstd/string.hpp"
+#include "tdo_fs_walker.hpp"
+
+#include <cstddef>
+
+
+namespace
+{
+  class IndexBuilder final : public TDO::FSWalker::Callbacks
+  {
+  public:
+    IndexBuilder(TDO::FSIndex::EntryVec  &entries_,
+                 TDO::FSIndex::RecordVec &skipped_)
+      : entries(entries_),
+        skipped(skipped_)
+    {
+    }
+
+  public:
+    void
+    operator()(const std::filesystem::path &filepath_,
+               const TDO::DirectoryRecord  &record_,
+               const u32                    record_pos_,
+               TDO::DevStream              &stream_)
+    {
+      (void)stream_;
+
+      entries.push_back({filepath_,
+                         nonstd::string::as_lowercase(filepath_.generic_string()),
+                         record_,
+                         record_pos_});
+    }
+
+    Error
+    invalid_filename(const std::filesystem::path &,
+                     const std::string           &,
+                     const TDO::DirectoryRecord  &record_,
+                     const uint32_t,
+                     const Error                 &,
+                     TDO::DevStream              &) override
+    {
+      // Retail mastering output can contain otherwise harmless records
+      // with path-separator names (the German Panasonic sampler is one
+      // example). FSWalker cannot safely recurse through them, so skip
+      // them just as list and unpack do.
+      skipped.push_back(record_);
+      return Error();
+    }
+
+  public:
+    TDO::FSIndex::EntryVec  &entries;
+    TDO::FSIndex::RecordVec &skipped;
+  };
+}
+
+void
+TDO::FSIndex::build(TDO::DevStream &stream_)
+{
+  IndexBuilder builder(_entries,_skipped);
+  TDO::FSWalker fsw(stream_,builder,false);
+
+  _entries.clear();
+  _skipped.clear();
+  _by_record_pos.clear();
+
+  fsw.walk();
+
+  for(u64 i = 0; i < _entries.size(); i++)
+    _by_record_pos[_entries[i].record_pos] = i;
+}
+
+void
+TDO::FSIndex::update_record_sizes(TDO::DevStream &stream_,
+                                  const u32       record_pos_,
+                                  const u32       byte_count_,
+                                  const u32       block_count_)
+{
+  auto i = _by_record_pos.find(record_pos_);
+  if(i == _by_record_pos.end())
+    throw Error("directory record not in filesystem index");
+
+  stream_.file_seek(record_pos_);
+  stream_.data_byte_skip(offsetof(TDO::DirectoryRecord,byte_count));
+  stream_.write(byte_count_);
+  stream_.write(block_count_);
+
+  _entries[i->second].record.byte_count  = byte_count_;
+  _entries[i->second].record.block_count = block_count_;
+}
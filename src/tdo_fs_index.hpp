@@ -0,0 +1,74 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "tdo_dev_stream.hpp"
+#include "tdo_directory_record.hpp"
+#include "types_ints.h"
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace TDO
+{
+  // Flat table of every named directory record on an image, captured
+  // by a single FSWalker pass with ROMTag size overrides disabled.
+  // Callers that run several phases over the same image replay the
+  // table instead of re-reading the directory tree, and keep it in
+  // sync through update_record_sizes() when they rewrite a record.
+  // Records with invalid filenames are skipped just as list and
+  // unpack skip them; skipped() keeps them for checks that still
+  // apply to every record.
+  class FSIndex
+  {
+  public:
+    struct Entry
+    {
+      std::filesystem::path path;
+      std::string           lc_path;
+      TDO::DirectoryRecord  record;
+      u32                   record_pos;
+    };
+
+    typedef std::vector<Entry> EntryVec;
+    typedef std::vector<TDO::DirectoryRecord> RecordVec;
+
+  public:
+    void build(TDO::DevStream &stream);
+
+  public:
+    const EntryVec& entries() const { return _entries; }
+    EntryVec::const_iterator begin() const { return _entries.begin(); }
+    EntryVec::const_iterator end() const { return _entries.end(); }
+    const RecordVec& skipped() const { return _skipped; }
+
+  public:
+    void update_record_sizes(TDO::DevStream &stream,
+                             const u32       record_pos,
+                             const u32       byte_count,
+                             const u32       block_count);
+
+  private:
+    EntryVec                     _entries;
+    RecordVec                    _skipped;
+    std::unordered_map<u32,u64>  _by_record_pos;
+  };
+}
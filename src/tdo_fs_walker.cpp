@@ -18,9 +18,11 @@
 
 #include "error.hpp"
 #include "fmt.hpp"
+#include "log.hpp"
 #include "tdo_romtag.hpp"
 #include "tdo_fs_walker.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <filesystem>
 #include <limits>
@@ -30,6 +32,7 @@
 
 namespace fs = std::filesystem;
 typedef TDO::FSWalker::Callbacks Callbacks;
+typedef TDO::FSWalker::ROMTagIndex ROMTagIndex;
 
 
 static
@@ -49,17 +52,13 @@ romtag_size_is_byte_count(const TDO::ROMTag &tag_)
   return true;
 }
 
-static
-Error
-update_record(const TDO::ROMTagVec &tags_,
-              TDO::DirectoryRecord &dr_)
+TDO::FSWalker::ROMTagIndex::ROMTagIndex(const TDO::ROMTagVec &romtags_)
+  : _romtags(romtags_)
 {
-  bool matched = false;
-  uint32_t matched_avatar = 0;
-  uint32_t matched_byte_count = 0;
-
-  for(const auto &tag : tags_)
+  for(u32 i = 0; i < _romtags.size(); i++)
     {
+      const auto &tag = _romtags[i];
+
       if(!romtag_size_is_byte_count(tag))
         continue;
       // Skip tags whose offset+1 would wrap in u32 space; comparing
@@ -69,55 +68,81 @@ update_record(const TDO::ROMTagVec &tags_,
       if(tag.offset == std::numeric_limits<uint32_t>::max())
         continue;
 
-      // Iterate over avatar_list directly rather than through
-      // last_avatar_index. The parser maintains
-      // avatar_list.size() == last_avatar_index + 1, but ranging on
-      // the container removes the indirect dependency and is robust
-      // against any future caller that constructs a DirectoryRecord
-      // without going through DevStream::read().
-      for(const uint32_t avatar : dr_.avatar_list)
+      // Indexes are appended in tag order so each bucket stays sorted.
+      _by_avatar[tag.offset + 1].push_back(i);
+    }
+}
+
+Error
+TDO::FSWalker::ROMTagIndex::apply(TDO::DirectoryRecord &dr_) const
+{
+  bool matched = false;
+  uint32_t matched_avatar = 0;
+  uint32_t matched_byte_count = 0;
+  std::vector<u32> tag_idxs;
+
+  if(_by_avatar.empty())
+    return Error();
+
+  // Iterate over avatar_list directly rather than through
+  // last_avatar_index. The parser maintains
+  // avatar_list.size() == last_avatar_index + 1, but ranging on
+  // the container removes the indirect dependency and is robust
+  // against any future caller that constructs a DirectoryRecord
+  // without going through DevStream::read().
+  for(const uint32_t avatar : dr_.avatar_list)
+    {
+      auto it = _by_avatar.find(avatar);
+      if(it == _by_avatar.end())
+        continue;
+      tag_idxs.insert(tag_idxs.end(),it->second.begin(),it->second.end());
+    }
+
+  // Resolve matches in tag order, once per tag, so duplicate
+  // warnings and the kept match are the same as scanning every tag
+  // against every avatar.
+  std::sort(tag_idxs.begin(),tag_idxs.end());
+  tag_idxs.erase(std::unique(tag_idxs.begin(),tag_idxs.end()),tag_idxs.end());
+
+  for(const u32 idx : tag_idxs)
+    {
+      const auto &tag = _romtags[idx];
+      const uint32_t avatar = tag.offset + 1;
+      const u64 max_byte_count =
+        static_cast<u64>(dr_.block_count) * static_cast<u64>(dr_.block_size);
+
+      if(tag.size > max_byte_count)
         {
-          if(tag.offset+1 == avatar)
-            {
-              const u64 max_byte_count =
-                static_cast<u64>(dr_.block_count) * static_cast<u64>(dr_.block_size);
-
-              if(tag.size > max_byte_count)
-                {
-                  return {fmt::format("invalid ROMTag size exceeds directory record allocation "
-                                      "(avatar {} size {}b capacity {}b)",
-                                      avatar,
-                                      tag.size,
-                                      max_byte_count)};
-                }
-
-              if(matched)
-                {
-                  // Multiple ROMTags claim the same DirectoryRecord
-                  // (each via some avatar in the record's
-                  // avatar_list). Keep the first match (preserving
-                  // previous behavior) and warn rather than silently
-                  // picking last-writer-wins. Report both avatars:
-                  // when two tags hit different avatars of the same
-                  // record, naming only the first match's block
-                  // sends users hunting for a non-existent collision.
-                  fmt::print(stderr,
-                             "3dt: warning: multiple ROM tags reference directory record "
-                             "(kept avatar {} size {}b, ignoring avatar {} size {}b)\n",
-                             matched_avatar,
-                             matched_byte_count,
-                             avatar,
-                             tag.size);
-                }
-              else
-                {
-                  dr_.byte_count = tag.size;
-                  matched = true;
-                  matched_avatar = avatar;
-                  matched_byte_count = tag.size;
-                }
-              break;
-            }
+          return {fmt::format("invalid ROMTag size exceeds directory record allocation "
+                              "(avatar {} size {}b capacity {}b)",
+                              avatar,
+                              tag.size,
+                              max_byte_count)};
+        }
+
+      if(matched)
+        {
+          // Multiple ROMTags claim the same DirectoryRecord
+          // (each via some avatar in the record's
+          // avatar_list). Keep the first match (preserving
+          // previous behavior) and warn rather than silently
+          // picking last-writer-wins. Report both avatars:
+          // when two tags hit different avatars of the same
+          // record, naming only the first match's block
+          // sends users hunting for a non-existent collision.
+          Log::warning(fmt::format("multiple ROM tags reference directory record "
+                                   "(kept avatar {} size {}b, ignoring avatar {} size {}b)",
+                                   matched_avatar,
+                                   matched_byte_count,
+                                   avatar,
+                                   tag.size));
+        }
+      else
+        {
+          dr_.byte_count = tag.size;
+          matched = true;
+          matched_avatar = avatar;
+          matched_byte_count = tag.size;
         }
     }
 
@@ -246,7 +271,7 @@ public:
 public:
   Error
   walk_v1_dir_block(const TDO::DiscLabel &label_,
-                      const TDO::ROMTagVec &romtags_,
+                      const ROMTagIndex    &romtags_,
                       const std::int64_t    active_dir_byte_pos_,
                       const std::int64_t    active_dir_end_,
                       const std::int64_t    dh_data_byte_pos_,
@@ -259,6 +284,7 @@ public:
   {
     TDO::DirectoryHeader dh;
     std::int64_t data_byte_pos;
+    std::vector<char> block;
     Error err;
 
     next_block_ = -1;
@@ -296,18 +322,24 @@ public:
         return Error();
       }
 
-    _stream.data_byte_seek(data_byte_pos);
+    // Fetch the records in one request and parse them from memory.
+    // Only the bytes up to first_free_byte are read, as when they were
+    // read record by record; the unused tail of the block may lie
+    // beyond the end of a truncated image. Offsets below stay data
+    // byte positions so the bounds checks read the same as they would
+    // against the stream; (pos - dh_data_byte_pos_) indexes the buffer.
+    _stream.read_data_bytes(block,dh_data_byte_pos_,dh.first_free_byte);
 
     while(true)
       {
-        const std::int64_t dr_pos = _stream.data_byte_tell();
-        // file_tell() returns s64; the callback contract takes the
+        const std::int64_t dr_pos = data_byte_pos;
+        // The file offset is s64; the callback contract takes the
         // record's file position as uint32_t. Match the v2 walker's
         // pattern (see walk_v2 below) and reject any v1 directory
         // record whose file offset would not fit in u32 rather than
         // silently narrowing — image_size is bounded only by the
         // underlying stream and can exceed 4 GiB.
-        const s64 dr_file_pos_s64 = _stream.file_tell();
+        const s64 dr_file_pos_s64 = _stream.data_byte_to_file_offset(dr_pos);
         if((dr_file_pos_s64 < 0) ||
            (dr_file_pos_s64 > static_cast<s64>(std::numeric_limits<uint32_t>::max())))
           return {"invalid OperaFS v1 directory record: file position out of range"};
@@ -315,6 +347,8 @@ public:
         TDO::DirectoryRecord dr;
         std::string decoded_filename;
         std::int64_t next_pos;
+        u64 block_offset;
+        u64 record_size;
 
         if(dr_pos < data_byte_pos)
           return {"invalid OperaFS directory read position: reversed record offset"};
@@ -324,9 +358,15 @@ public:
         if(err)
           return err;
 
-        _stream.read(dr);
+        block_offset = static_cast<u64>(dr_pos - dh_data_byte_pos_);
+        record_size  = _stream.parse(block.data() + block_offset,
+                                     block.size() - block_offset,
+                                     dr_pos,
+                                     dr);
+        if(record_size == 0)
+          return {"invalid OperaFS directory record: extends beyond directory data"};
 
-        next_pos = _stream.data_byte_tell();
+        next_pos = dr_pos + static_cast<std::int64_t>(record_size);
         if(next_pos <= dr_pos)
           return {"invalid OperaFS directory read position: non-advancing record read"};
         if(next_pos > first_free_byte_pos)
@@ -335,13 +375,14 @@ public:
         if(err)
           return err;
 
-        err = update_record(romtags_,dr);
+        err = romtags_.apply(dr);
         if(err)
           return err;
         err = decode_v1_filename(dr,decoded_filename);
+        // The block was parsed from memory so callbacks are free to
+        // move the stream; no PosGuard is needed around them.
         if(err)
           {
-            TDO::PosGuard guard(_stream);
             err = _callbacks.invalid_filename(path_,
                                               decoded_filename,
                                               dr,
@@ -353,10 +394,7 @@ public:
           }
         else
           {
-            {
-              TDO::PosGuard guard(_stream);
-              _callbacks(path_ / decoded_filename,dr,dr_file_pos,_stream);
-            }
+            _callbacks(path_ / decoded_filename,dr,dr_file_pos,_stream);
 
             if(dr.is_directory())
               {
@@ -379,7 +417,7 @@ public:
           }
         if(dr.last_in_block())
           break;
-        if(_stream.data_byte_tell() >= first_free_byte_pos)
+        if(next_pos >= first_free_byte_pos)
           break;
 
         data_byte_pos = next_pos;
@@ -390,7 +428,7 @@ public:
 
   Error
   walk_v1_dir(const TDO::DiscLabel &label_,
-              const TDO::ROMTagVec &romtags_,
+              const ROMTagIndex    &romtags_,
               const std::uint32_t   dir_block_,
               const std::uint32_t   dir_block_size_,
               const std::uint32_t   dir_block_count_,
@@ -479,7 +517,7 @@ public:
 
   Error
   walk_v1_dir(const TDO::DiscLabel       &label_,
-              const TDO::ROMTagVec       &romtags_,
+              const ROMTagIndex          &romtags_,
               const TDO::DirectoryRecord &parent_,
               const fs::path             &path_)
   {
@@ -493,7 +531,7 @@ public:
 
   Error
   walk_v1_root_dir(const TDO::DiscLabel &label_,
-                   const TDO::ROMTagVec &romtags_,
+                   const ROMTagIndex    &romtags_,
                    const fs::path       &path_)
   {
     return walk_v1_dir(label_,
@@ -606,14 +644,14 @@ public:
     Error err;
     fs::path path;
     TDO::DiscLabel dl;
-    TDO::ROMTagVec romtags;
+    ROMTagIndex romtags;
 
     _stream.setup();
 
     dl = _stream.disc_label();
 
     if(_use_existing_romtags)
-      romtags = _stream.romtags();
+      romtags = ROMTagIndex(_stream.romtags());
 
     _callbacks.begin();
     switch(dl.volume_structure_version)
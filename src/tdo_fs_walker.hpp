@@ -25,6 +25,8 @@
 #include <functional>
 #include <istream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 // TODO: Add way to exit walk
 namespace TDO
@@ -67,6 +69,26 @@ namespace TDO
   public:
     void walk();
 
+  public:
+    // The ROMTags that may override a record's byte_count keyed by the
+    // avatar they point at. Built once per walk so resolving a record
+    // costs one lookup per avatar rather than a scan of every tag.
+    class ROMTagIndex
+    {
+    public:
+      ROMTagIndex() = default;
+      explicit ROMTagIndex(const TDO::ROMTagVec &romtags);
+
+    public:
+      // Applies the ROMTag size overrides a use_existing_romtags walk
+      // would apply to a record read with them disabled.
+      Error apply(TDO::DirectoryRecord &dr) const;
+
+    private:
+      TDO::ROMTagVec                                     _romtags;
+      std::unordered_map<uint32_t,std::vector<uint32_t>> _by_avatar;
+    };
+
   private:
     Callbacks     &_callbacks;
     std::iostream &_ios;
@@ -0,0 +1,684 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "tdo_image_fstream.hpp"
+
+#include "error.hpp"
+#include "file_copier.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace TDO
+{
+  MappedFileBuf::MappedFileBuf()
+    : _data(nullptr),
+      _size(0)
+  {
+  }
+
+  MappedFileBuf::~MappedFileBuf()
+  {
+    close();
+  }
+
+  bool
+  MappedFileBuf::open(const std::filesystem::path &filepath_)
+  {
+#if defined(_WIN32)
+    (void)filepath_;
+    return false;
+#else
+    int fd;
+    int rv;
+    void *addr;
+    struct stat st;
+
+    close();
+
+    fd = ::open(filepath_.c_str(),O_RDONLY);
+    if(fd < 0)
+      return false;
+
+    // Only regular files have a stable size worth mapping. Pipes,
+    // FIFOs and devices fall back to the buffered stream path.
+    rv = ::fstat(fd,&st);
+    if((rv != 0) || !S_ISREG(st.st_mode) || (st.st_size <= 0) ||
+       (static_cast<u64>(st.st_size) > std::numeric_limits<std::size_t>::max()))
+      {
+        ::close(fd);
+        return false;
+      }
+
+    addr = ::mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    if(addr == MAP_FAILED)
+      return false;
+
+    _data = static_cast<char*>(addr);
+    _size = static_cast<u64>(st.st_size);
+    setg(_data,_data,_data + _size);
+
+    return true;
+#endif
+  }
+
+  void
+  MappedFileBuf::close()
+  {
+    if(_data == nullptr)
+      return;
+
+#if !defined(_WIN32)
+    ::munmap(_data,_size);
+#endif
+
+    _data = nullptr;
+    _size = 0;
+    setg(nullptr,nullptr,nullptr);
+  }
+
+  bool
+  MappedFileBuf::is_open() const
+  {
+    return (_data != nullptr);
+  }
+
+  const
+  char*
+  MappedFileBuf::data() const
+  {
+    return _data;
+  }
+
+  u64
+  MappedFileBuf::size() const
+  {
+    return _size;
+  }
+
+  u64
+  MappedFileBuf::tell() const
+  {
+    return static_cast<u64>(gptr() - eback());
+  }
+
+  u64
+  MappedFileBuf::read(char      *buf_,
+                      const u64  size_)
+  {
+    u64 n;
+
+    n = std::min<u64>(size_,static_cast<u64>(egptr() - gptr()));
+    if(n == 0)
+      return 0;
+
+    std::memcpy(buf_,gptr(),n);
+    setg(eback(),gptr() + n,egptr());
+
+    return n;
+  }
+
+  MappedFileBuf::pos_type
+  MappedFileBuf::seekoff(off_type                off_,
+                         std::ios_base::seekdir  dir_,
+                         std::ios_base::openmode)
+  {
+    off_type base;
+    off_type pos;
+
+    if(_data == nullptr)
+      return pos_type(off_type(-1));
+
+    switch(dir_)
+      {
+      case std::ios_base::beg:
+        base = 0;
+        break;
+      case std::ios_base::cur:
+        base = static_cast<off_type>(tell());
+        break;
+      case std::ios_base::end:
+        base = static_cast<off_type>(_size);
+        break;
+      default:
+        return pos_type(off_type(-1));
+      }
+
+    // Reads and seeks share one cursor, just like std::filebuf, so
+    // DevStream::file_seek's paired seekg/seekp lands on one position.
+    pos = base + off_;
+    if((pos < 0) || (static_cast<u64>(pos) > _size))
+      return pos_type(off_type(-1));
+
+    setg(_data,_data + pos,_data + _size);
+
+    return pos_type(pos);
+  }
+
+  MappedFileBuf::pos_type
+  MappedFileBuf::seekpos(pos_type                pos_,
+                         std::ios_base::openmode which_)
+  {
+    return seekoff(off_type(pos_),std::ios_base::beg,which_);
+  }
+
+  std::streamsize
+  MappedFileBuf::showmanyc()
+  {
+    const u64 n = static_cast<u64>(egptr() - gptr());
+
+    if(n == 0)
+      return -1;
+
+    return static_cast<std::streamsize>(n);
+  }
+
+  std::streamsize
+  MappedFileBuf::xsgetn(char            *buf_,
+                        std::streamsize  size_)
+  {
+    if(size_ <= 0)
+      return 0;
+
+    return static_cast<std::streamsize>(read(buf_,static_cast<u64>(size_)));
+  }
+
+  MappedFileBuf::int_type
+  MappedFileBuf::underflow()
+  {
+    if(gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+
+    return traits_type::eof();
+  }
+
+  namespace
+  {
+    constexpr u64 OVERLAY_PAGE_SIZE = 4096;
+  }
+
+  OverlayFileBuf::OverlayFileBuf()
+    : _base_size(0),
+      _size(0),
+      _pos(0),
+      _ch(0)
+  {
+  }
+
+  OverlayFileBuf::~OverlayFileBuf()
+  {
+    close();
+  }
+
+  bool
+  OverlayFileBuf::open(const std::filesystem::path &filepath_)
+  {
+    pos_type end;
+
+    close();
+
+    // Clean ranges are read from a mapping of the original when one
+    // can be made, the same as a plain read-only open.
+    if(_mapped.open(filepath_))
+      {
+        _filepath  = filepath_;
+        _base_size = _mapped.size();
+        _size      = _base_size;
+        _pos       = 0;
+
+        return true;
+      }
+
+    if(_base.open(filepath_,std::ios::in|std::ios::binary) == nullptr)
+      return false;
+
+    end = _base.pubseekoff(0,std::ios::end,std::ios::in);
+    if(end == pos_type(off_type(-1)))
+      {
+        _base.close();
+        return false;
+      }
+
+    _filepath  = filepath_;
+    _base_size = static_cast<u64>(off_type(end));
+    _size      = _base_size;
+    _pos       = 0;
+
+    return true;
+  }
+
+  void
+  OverlayFileBuf::close()
+  {
+    _mapped.close();
+    if(_base.is_open())
+      _base.close();
+    _pages.clear();
+    _filepath.clear();
+    _base_size = 0;
+    _size      = 0;
+    _pos       = 0;
+    setg(nullptr,nullptr,nullptr);
+  }
+
+  bool
+  OverlayFileBuf::is_open() const
+  {
+    return (_mapped.is_open() || _base.is_open());
+  }
+
+  void
+  OverlayFileBuf::save(const std::filesystem::path &filepath_)
+  {
+    u64 pos;
+    std::ofstream os;
+    std::error_code ec;
+    std::filesystem::perms perms;
+
+    if(!is_open())
+      throw Error("no image open to save");
+
+    os.open(filepath_,std::ios::binary|std::ios::trunc);
+    if(!os)
+      throw Error("failed to open output image: " + filepath_.string());
+
+    {
+      util::FileCopier copier(filepath_,os);
+
+      // A reflink shares every unmodified extent with the original so
+      // only the dirty pages are written. Otherwise the unmodified
+      // ranges are copied in between the pages in file order.
+      if(copier.clone(_filepath))
+        {
+          for(const auto &[offset,page] : _pages)
+            {
+              os.seekp(static_cast<std::streamoff>(offset),std::ios::beg);
+              os.write(page.data(),std::min<u64>(page.size(),_size - offset));
+            }
+        }
+      else
+        {
+          pos = 0;
+          for(const auto &[offset,page] : _pages)
+            {
+              // The copier writes through its own descriptor so the
+              // pages already written must reach the file first.
+              if((pos < offset) && (pos < _base_size))
+                {
+                  os.flush();
+                  copier.copy(_filepath,
+                              pos,
+                              std::min(offset,_base_size) - pos,
+                              {pos});
+                }
+              os.seekp(static_cast<std::streamoff>(offset),std::ios::beg);
+              os.write(page.data(),std::min<u64>(page.size(),_size - offset));
+              pos = offset + page.size();
+            }
+          if(pos < _base_size)
+            {
+              os.flush();
+              copier.copy(_filepath,pos,_base_size - pos,{pos});
+            }
+        }
+    }
+
+    os.flush();
+    if(!os)
+      throw Error("failed to write output image: " + filepath_.string());
+    os.close();
+    if(os.fail())
+      throw Error("failed to close output image: " + filepath_.string());
+
+    // The output replaces the original in place signing so it keeps
+    // the original's mode rather than the default for new files.
+    perms = std::filesystem::status(_filepath,ec).permissions();
+    if(!ec)
+      std::filesystem::permissions(filepath_,perms,ec);
+    if(ec)
+      throw Error("failed to set permissions of output image: " +
+                  filepath_.string() + " - " + ec.message());
+  }
+
+  // An underflow() hands out one character through a get area the
+  // rest of the buffer does not use. Fold it back into _pos before
+  // anything else looks at the position.
+  void
+  OverlayFileBuf::_sync_get_area()
+  {
+    if(eback() == nullptr)
+      return;
+
+    _pos += static_cast<u64>(gptr() - eback());
+    setg(nullptr,nullptr,nullptr);
+  }
+
+  // Bytes past the end of the original file read as zero, as they
+  // would after extending a real file.
+  void
+  OverlayFileBuf::_read_base(char      *buf_,
+                             const u64  pos_,
+                             const u64  size_)
+  {
+    u64 n;
+
+    n = ((pos_ < _base_size) ? std::min(size_,_base_size - pos_) : 0);
+    if((n > 0) && _mapped.is_open())
+      {
+        std::memcpy(buf_,_mapped.data() + pos_,n);
+      }
+    else if(n > 0)
+      {
+        if(_base.pubseekpos(pos_type(off_type(pos_)),std::ios::in) == pos_type(off_type(-1)))
+          throw Error("failed to seek image: " + _filepath.string());
+        if(_base.sgetn(buf_,n) != static_cast<std::streamsize>(n))
+          throw Error("failed to read image: " + _filepath.string());
+      }
+
+    std::memset(buf_ + n,0,size_ - n);
+  }
+
+  // Dirty pages are copied one at a time. Each run of clean pages
+  // between them is a single read of the original.
+  void
+  OverlayFileBuf::_read(char *buf_,
+                        u64   pos_,
+                        u64   size_)
+  {
+    while(size_ > 0)
+      {
+        u64 n;
+        const u64 offset = (pos_ - (pos_ % OVERLAY_PAGE_SIZE));
+        const auto page  = _pages.lower_bound(offset);
+
+        if((page != _pages.end()) && (page->first == offset))
+          {
+            n = std::min(size_,(offset + OVERLAY_PAGE_SIZE) - pos_);
+            std::memcpy(buf_,&page->second[pos_ - offset],n);
+          }
+        else
+          {
+            n = ((page == _pages.end()) ?
+                 size_ :
+                 std::min(size_,page->first - pos_));
+            _read_base(buf_,pos_,n);
+          }
+
+        buf_  += n;
+        pos_  += n;
+        size_ -= n;
+      }
+  }
+
+  void
+  OverlayFileBuf::_write(const char *buf_,
+                         u64         pos_,
+                         u64         size_)
+  {
+    _size = std::max(_size,pos_ + size_);
+    while(size_ > 0)
+      {
+        const u64 offset = (pos_ - (pos_ % OVERLAY_PAGE_SIZE));
+        const u64 n      = std::min(size_,(offset + OVERLAY_PAGE_SIZE) - pos_);
+        auto page        = _pages.find(offset);
+
+        if(page == _pages.end())
+          {
+            page = _pages.emplace(offset,std::vector<char>(OVERLAY_PAGE_SIZE)).first;
+            _read_base(page->second.data(),offset,OVERLAY_PAGE_SIZE);
+          }
+
+        std::memcpy(&page->second[pos_ - offset],buf_,n);
+
+        buf_  += n;
+        pos_  += n;
+        size_ -= n;
+      }
+  }
+
+  OverlayFileBuf::pos_type
+  OverlayFileBuf::seekoff(off_type                off_,
+                          std::ios_base::seekdir  dir_,
+                          std::ios_base::openmode)
+  {
+    off_type base;
+    off_type pos;
+
+    if(!is_open())
+      return pos_type(off_type(-1));
+
+    _sync_get_area();
+    switch(dir_)
+      {
+      case std::ios_base::beg:
+        base = 0;
+        break;
+      case std::ios_base::cur:
+        base = static_cast<off_type>(_pos);
+        break;
+      case std::ios_base::end:
+        base = static_cast<off_type>(_size);
+        break;
+      default:
+        return pos_type(off_type(-1));
+      }
+
+    // One cursor for reads and writes, like std::filebuf.
+    pos = base + off_;
+    if(pos < 0)
+      return pos_type(off_type(-1));
+
+    _pos = static_cast<u64>(pos);
+
+    return pos_type(pos);
+  }
+
+  OverlayFileBuf::pos_type
+  OverlayFileBuf::seekpos(pos_type                pos_,
+                          std::ios_base::openmode which_)
+  {
+    return seekoff(off_type(pos_),std::ios_base::beg,which_);
+  }
+
+  std::streamsize
+  OverlayFileBuf::showmanyc()
+  {
+    _sync_get_area();
+    if(_pos >= _size)
+      return -1;
+
+    return static_cast<std::streamsize>(_size - _pos);
+  }
+
+  std::streamsize
+  OverlayFileBuf::xsgetn(char            *buf_,
+                         std::streamsize  size_)
+  {
+    u64 n;
+
+    _sync_get_area();
+    if((size_ <= 0) || (_pos >= _size))
+      return 0;
+
+    n = std::min<u64>(size_,_size - _pos);
+    _read(buf_,_pos,n);
+    _pos += n;
+
+    return static_cast<std::streamsize>(n);
+  }
+
+  OverlayFileBuf::int_type
+  OverlayFileBuf::underflow()
+  {
+    if(gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+
+    _sync_get_area();
+    if(_pos >= _size)
+      return traits_type::eof();
+
+    _read(&_ch,_pos,1);
+    setg(&_ch,&_ch,&_ch + 1);
+
+    return traits_type::to_int_type(_ch);
+  }
+
+  std::streamsize
+  OverlayFileBuf::xsputn(const char      *buf_,
+                         std::streamsize  size_)
+  {
+    _sync_get_area();
+    if(size_ <= 0)
+      return 0;
+
+    _write(buf_,_pos,size_);
+    _pos += size_;
+
+    return size_;
+  }
+
+  OverlayFileBuf::int_type
+  OverlayFileBuf::overflow(int_type c_)
+  {
+    char c;
+
+    if(traits_type::eq_int_type(c_,traits_type::eof()))
+      return traits_type::not_eof(c_);
+
+    c = traits_type::to_char_type(c_);
+    xsputn(&c,1);
+
+    return c_;
+  }
+
+  ImageFStream::ImageFStream()
+    : std::iostream(nullptr),
+      _fd(-1)
+  {
+  }
+
+  ImageFStream::~ImageFStream()
+  {
+    close();
+  }
+
+  void
+  ImageFStream::open(const std::filesystem::path &filepath_,
+                     const std::ios::openmode     mode_)
+  {
+    close();
+
+    // A reopened stream must not keep the failbit or eofbit of an
+    // earlier read or of close().
+    if(((mode_ & std::ios::out) == 0) && _mappedbuf.open(filepath_))
+      {
+        rdbuf(&_mappedbuf);
+        clear();
+        return;
+      }
+
+    if(_filebuf.open(filepath_,mode_|std::ios::binary) == nullptr)
+      {
+        rdbuf(nullptr);
+        setstate(std::ios::failbit);
+        return;
+      }
+
+    rdbuf(&_filebuf);
+    clear();
+
+#if !defined(_WIN32)
+    // Pipes have no positions to read from so they keep no descriptor.
+    if((mode_ & std::ios::out) == 0)
+      {
+        _fd = ::open(filepath_.c_str(),O_RDONLY|O_CLOEXEC);
+        if((_fd >= 0) && (::lseek(_fd,0,SEEK_CUR) < 0))
+          {
+            ::close(_fd);
+            _fd = -1;
+          }
+      }
+#endif
+  }
+
+  void
+  ImageFStream::open_overlay(const std::filesystem::path &filepath_)
+  {
+    close();
+
+    if(!_overlaybuf.open(filepath_))
+      {
+        rdbuf(nullptr);
+        setstate(std::ios::failbit);
+        return;
+      }
+
+    rdbuf(&_overlaybuf);
+    clear();
+  }
+
+  void
+  ImageFStream::save_overlay(const std::filesystem::path &filepath_)
+  {
+    _overlaybuf.save(filepath_);
+  }
+
+  void
+  ImageFStream::close()
+  {
+    _mappedbuf.close();
+    _overlaybuf.close();
+    if(_filebuf.is_open() && (_filebuf.close() == nullptr))
+      setstate(std::ios::failbit);
+#if !defined(_WIN32)
+    if(_fd >= 0)
+      ::close(_fd);
+#endif
+    _fd = -1;
+  }
+
+  bool
+  ImageFStream::is_open() const
+  {
+    return (_mappedbuf.is_open() ||
+            _overlaybuf.is_open() ||
+            _filebuf.is_open());
+  }
+
+  bool
+  ImageFStream::is_mapped() const
+  {
+    return _mappedbuf.is_open();
+  }
+
+  int
+  ImageFStream::fd() const
+  {
+    return _fd;
+  }
+}
@@ -0,0 +1,157 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <streambuf>
+#include <vector>
+
+namespace TDO
+{
+  // Read-only streambuf over a memory mapped regular file. The whole
+  // mapping is exposed as the get area so seeks and reads never reach
+  // the kernel. DevStream recognizes this buffer and reads data bytes
+  // straight out of the mapping.
+  class MappedFileBuf : public std::streambuf
+  {
+  public:
+    MappedFileBuf();
+    ~MappedFileBuf();
+
+    MappedFileBuf(const MappedFileBuf&) = delete;
+    MappedFileBuf& operator=(const MappedFileBuf&) = delete;
+
+  public:
+    bool open(const std::filesystem::path &filepath);
+    void close();
+    bool is_open() const;
+
+  public:
+    const char *data() const;
+    u64 size() const;
+    u64 tell() const;
+    u64 read(char *buf, const u64 size);
+
+  protected:
+    pos_type seekoff(off_type                off,
+                     std::ios_base::seekdir  dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type                pos,
+                     std::ios_base::openmode which) override;
+    std::streamsize showmanyc() override;
+    std::streamsize xsgetn(char *buf, std::streamsize size) override;
+    int_type underflow() override;
+
+  private:
+    char *_data;
+    u64   _size;
+  };
+
+  // Copy-on-write streambuf over a file opened read-only. Reads see
+  // the file with every write applied but writes only touch pages
+  // held in memory. The original is memory mapped where possible.
+  // save() then produces the modified file in one pass: a reflink
+  // clone or streamed copy of the original plus the dirty pages.
+  class OverlayFileBuf : public std::streambuf
+  {
+  public:
+    OverlayFileBuf();
+    ~OverlayFileBuf();
+
+    OverlayFileBuf(const OverlayFileBuf&) = delete;
+    OverlayFileBuf& operator=(const OverlayFileBuf&) = delete;
+
+  public:
+    bool open(const std::filesystem::path &filepath);
+    void close();
+    bool is_open() const;
+
+  public:
+    // Writes the modified file to filepath, which must not be the
+    // file this buffer was opened on.
+    void save(const std::filesystem::path &filepath);
+
+  protected:
+    pos_type seekoff(off_type                off,
+                     std::ios_base::seekdir  dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type                pos,
+                     std::ios_base::openmode which) override;
+    std::streamsize showmanyc() override;
+    std::streamsize xsgetn(char *buf, std::streamsize size) override;
+    int_type underflow() override;
+    std::streamsize xsputn(const char *buf, std::streamsize size) override;
+    int_type overflow(int_type c) override;
+
+  private:
+    void _sync_get_area();
+    void _read_base(char *buf, const u64 pos, const u64 size);
+    void _read(char *buf, u64 pos, u64 size);
+    void _write(const char *buf, u64 pos, u64 size);
+
+  private:
+    std::filesystem::path           _filepath;
+    MappedFileBuf                   _mapped;
+    std::filebuf                    _base;
+    u64                             _base_size;
+    u64                             _size;
+    u64                             _pos;
+    std::map<u64,std::vector<char>> _pages;
+    char                            _ch;
+  };
+
+  // Drop in replacement for the std::fstream used to open disc
+  // images. Read-only opens of regular files are memory mapped. Read
+  // and write opens, pipes, character devices and platforms without
+  // mmap go through a regular std::filebuf.
+  class ImageFStream : public std::iostream
+  {
+  public:
+    ImageFStream();
+    ~ImageFStream();
+
+  public:
+    void open(const std::filesystem::path &filepath,
+              const std::ios::openmode     mode = std::ios::in);
+    void close();
+    bool is_open() const;
+    bool is_mapped() const;
+    // Read-only descriptor of a seekable file opened read-only that
+    // could not be mapped, for positional reads that bypass the
+    // stream. -1 otherwise.
+    int fd() const;
+
+  public:
+    // Opens filepath read-only with writes kept in memory until
+    // save_overlay() writes the result to another file.
+    void open_overlay(const std::filesystem::path &filepath);
+    void save_overlay(const std::filesystem::path &filepath);
+
+  private:
+    std::filebuf   _filebuf;
+    MappedFileBuf  _mappedbuf;
+    OverlayFileBuf _overlaybuf;
+    int            _fd;
+  };
+}
@@ -75,6 +75,30 @@ tdo_keys_m1_retail_app_d(void)
   return bigd_from_hex_str(M1_RETAIL_APP_D_STR);
 }
 
+BIGD
+tdo_keys_m1_retail_3do_p(void)
+{
+  return bigd_from_hex_str(M1_RETAIL_3DO_P_STR);
+}
+
+BIGD
+tdo_keys_m1_retail_3do_q(void)
+{
+  return bigd_from_hex_str(M1_RETAIL_3DO_Q_STR);
+}
+
+BIGD
+tdo_keys_m1_retail_app_p(void)
+{
+  return bigd_from_hex_str(M1_RETAIL_APP_P_STR);
+}
+
+BIGD
+tdo_keys_m1_retail_app_q(void)
+{
+  return bigd_from_hex_str(M1_RETAIL_APP_Q_STR);
+}
+
 BIGD
 tdo_keys_m1_retail_message(md5_digest_t digest_)
 {
@@ -111,6 +135,26 @@ tdo_keys_d(const char *key_)
   throw Error("unknown key: " + std::string(key_));
 }
 
+BIGD
+tdo_keys_p(const char *key_)
+{
+  if(std::strcmp(key_,"3do") == 0)
+    return tdo_keys_m1_retail_3do_p();
+  if(std::strcmp(key_,"app") == 0)
+    return tdo_keys_m1_retail_app_p();
+  throw Error("unknown key: " + std::string(key_));
+}
+
+BIGD
+tdo_keys_q(const char *key_)
+{
+  if(std::strcmp(key_,"3do") == 0)
+    return tdo_keys_m1_retail_3do_q();
+  if(std::strcmp(key_,"app") == 0)
+    return tdo_keys_m1_retail_app_q();
+  throw Error("unknown key: " + std::string(key_));
+}
+
 BIGD
 tdo_keys_m(const char   *key_,
            md5_digest_t  digest_)
@@ -25,9 +25,15 @@ BIGD tdo_keys_m1_retail_3do_n();
 BIGD tdo_keys_m1_retail_3do_d();
 BIGD tdo_keys_m1_retail_app_n();
 BIGD tdo_keys_m1_retail_app_d();
+BIGD tdo_keys_m1_retail_3do_p();
+BIGD tdo_keys_m1_retail_3do_q();
+BIGD tdo_keys_m1_retail_app_p();
+BIGD tdo_keys_m1_retail_app_q();
 
 BIGD tdo_keys_m1_retail_message(md5_digest_t digest);
 
 BIGD tdo_keys_n(const char *key);
 BIGD tdo_keys_d(const char *key);
+BIGD tdo_keys_p(const char *key);
+BIGD tdo_keys_q(const char *key);
 BIGD tdo_keys_m(const char *key, md5_digest_t digest);
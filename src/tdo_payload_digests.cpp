@@ -0,0 +1,168 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "tdo_payload_digests.hpp"
+
+#include "tdo_dev_stream.hpp"
+#include "tdo_disc_format.hpp"
+
+#include <algorithm>
+
+// One saved state per block costs about 8% of the range's size.
+static constexpr u64 STATE_INTERVAL = TDO::BLOCK_SIZE;
+
+void
+TDO::PayloadDigests::track(const u64 pos_,
+                           const u64 size_)
+{
+  Range range;
+
+  range.size   = size_;
+  range.hashed = 0;
+  md5_init(&range.ctx);
+  range.states.assign(1,range.ctx);
+
+  _ranges[pos_] = std::move(range);
+}
+
+bool
+TDO::PayloadDigests::tracks(const u64 pos_) const
+{
+  return (_ranges.find(pos_) != _ranges.end());
+}
+
+void
+TDO::PayloadDigests::_hash(Range      &range_,
+                           const char *buf_,
+                           u64         size_)
+{
+  while(size_ > 0)
+    {
+      const u64 n = std::min(size_,
+                             STATE_INTERVAL - (range_.hashed % STATE_INTERVAL));
+
+      md5_update(&range_.ctx,buf_,n);
+      range_.hashed += n;
+      if((range_.hashed % STATE_INTERVAL) == 0)
+        range_.states.push_back(range_.ctx);
+
+      buf_  += n;
+      size_ -= n;
+    }
+}
+
+void
+TDO::PayloadDigests::_rewind(Range     &range_,
+                             const u64  offset_)
+{
+  if(offset_ >= range_.hashed)
+    return;
+
+  range_.states.resize((offset_ / STATE_INTERVAL) + 1);
+  range_.ctx    = range_.states.back();
+  range_.hashed = ((range_.states.size() - 1) * STATE_INTERVAL);
+}
+
+void
+TDO::PayloadDigests::update(const u64   pos_,
+                            const char *buf_,
+                            const u64   size_)
+{
+  for(auto &[range_pos,range] : _ranges)
+    {
+      const u64 begin = std::max(pos_,range_pos);
+      const u64 end   = std::min(pos_ + size_,range_pos + range.size);
+
+      if(begin >= end)
+        continue;
+
+      _rewind(range,begin - range_pos);
+      if((begin - range_pos) == range.hashed)
+        _hash(range,buf_ + (begin - pos_),end - begin);
+    }
+}
+
+void
+TDO::PayloadDigests::invalidate(const u64 pos_,
+                                const u64 size_)
+{
+  for(auto &[range_pos,range] : _ranges)
+    {
+      const u64 begin = std::max(pos_,range_pos);
+      const u64 end   = std::min(pos_ + size_,range_pos + range.size);
+
+      if(begin >= end)
+        continue;
+
+      _rewind(range,begin - range_pos);
+    }
+}
+
+bool
+TDO::PayloadDigests::digest(TDO::DevStream &stream_,
+                            const u64       pos_,
+                            const u64       size_,
+                            md5_digest_t    digest_) const
+{
+  u64 done;
+  md5_ctx_t ctx;
+
+  auto iter = _ranges.find(pos_);
+  if(iter == _ranges.end())
+    return false;
+
+  const Range &range = iter->second;
+  if(size_ > range.size)
+    return false;
+
+  if(size_ == range.hashed)
+    {
+      done = size_;
+      ctx  = range.ctx;
+    }
+  else
+    {
+      done = ((std::min(size_,range.hashed) / STATE_INTERVAL) * STATE_INTERVAL);
+      ctx  = range.states[done / STATE_INTERVAL];
+    }
+
+  if(done < size_)
+    {
+      const TDO::DataView data = stream_.data_bytes_view(pos_ + done,
+                                                         size_ - done);
+      md5_update(&ctx,data.data(),data.size());
+    }
+  md5_finalize(&ctx,digest_);
+
+  return true;
+}
+
+void
+TDO::md5_data_bytes(TDO::DevStream &stream_,
+                    const u64       pos_,
+                    const u64       size_,
+                    md5_digest_t    digest_)
+{
+  const TDO::PayloadDigests *digests = stream_.payload_digests();
+
+  if(digests && digests->digest(stream_,pos_,size_,digest_))
+    return;
+
+  const TDO::DataView data = stream_.data_bytes_view(pos_,size_);
+  md5_calc(data.data(),data.size(),digest_);
+}
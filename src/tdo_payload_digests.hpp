@@ -0,0 +1,83 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "md5.h"
+#include "types_ints.h"
+
+#include <map>
+#include <vector>
+
+namespace TDO
+{
+  class DevStream;
+
+  // MD5 state of ranges of an image's data bytes, computed while the
+  // bytes are written so signing and verifying don't read them back.
+  // The state is saved at every block of a range. A digest of any
+  // prefix resumes from the nearest saved state, and a later write
+  // into a range only drops the states after it, so only the bytes
+  // following the write are hashed again.
+  class PayloadDigests
+  {
+  public:
+    // Starts tracking size data bytes at pos. update() has to see
+    // them in order from pos.
+    void track(const u64 pos, const u64 size);
+    bool tracks(const u64 pos) const;
+
+  public:
+    // Bytes written at pos. Those continuing a range from where it was
+    // last hashed are hashed; bytes before that count as a change.
+    void update(const u64 pos, const char *buf, const u64 size);
+    // The bytes at [pos,pos+size) were changed by some other writer.
+    void invalidate(const u64 pos, const u64 size);
+
+  public:
+    // MD5 of size bytes at pos if pos starts a tracked range of at
+    // least size bytes. Bytes past the nearest saved state are read
+    // from stream. Returns false otherwise.
+    bool digest(DevStream    &stream,
+                const u64     pos,
+                const u64     size,
+                md5_digest_t  digest) const;
+
+  private:
+    struct Range
+    {
+      u64                    size;
+      u64                    hashed;
+      md5_ctx_t              ctx;
+      std::vector<md5_ctx_t> states;
+    };
+
+    static void _hash(Range &range, const char *buf, u64 size);
+    static void _rewind(Range &range, const u64 offset);
+
+  private:
+    std::map<u64,Range> _ranges;
+  };
+
+  // MD5 of size data bytes at pos. Uses the digests attached to
+  // stream when they cover the range and reads the bytes otherwise.
+  void md5_data_bytes(DevStream    &stream,
+                      const u64     pos,
+                      const u64     size,
+                      md5_digest_t  digest);
+}
@@ -0,0 +1,321 @@
+/*
+  ISC License
+
+  Copyright (c) 2025, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "tdo_directory_header.hpp"
+#include "tdo_directory_record.hpp"
+#include "tdo_disc_label.hpp"
+#include "tdo_linked_mem_file_entry.hpp"
+#include "tdo_romtag.hpp"
+#include "types_ints.h"
+
+#include <array>
+#include <cstddef>
+
+// On-disc OperaFS structures are packed big-endian. Each one is
+// described once below as an ordered list of member pointers and the
+// encoder and decoder are generated from that list, so readers and
+// writers can not disagree on layout. Everything works on contiguous
+// byte buffers; callers do one stream read or write per structure.
+namespace TDO::Codec
+{
+  constexpr
+  u32
+  load_be32(const char *p_)
+  {
+    return ((static_cast<u32>(static_cast<u8>(p_[0])) << 24) |
+            (static_cast<u32>(static_cast<u8>(p_[1])) << 16) |
+            (static_cast<u32>(static_cast<u8>(p_[2])) <<  8) |
+            (static_cast<u32>(static_cast<u8>(p_[3])) <<  0));
+  }
+
+  constexpr
+  void
+  store_be32(char      *p_,
+             const u32  v_)
+  {
+    p_[0] = static_cast<char>(v_ >> 24);
+    p_[1] = static_cast<char>(v_ >> 16);
+    p_[2] = static_cast<char>(v_ >>  8);
+    p_[3] = static_cast<char>(v_ >>  0);
+  }
+
+  // Arrays of u32 are swapped in a plain loop over independent
+  // elements which compilers turn into vector shuffles.
+  constexpr
+  void
+  load_be32_array(const char  *p_,
+                  u32         *dst_,
+                  std::size_t  count_)
+  {
+    for(std::size_t i = 0; i < count_; i++)
+      dst_[i] = load_be32(p_ + (i * sizeof(u32)));
+  }
+
+  constexpr
+  void
+  store_be32_array(char        *p_,
+                   const u32   *src_,
+                   std::size_t  count_)
+  {
+    for(std::size_t i = 0; i < count_; i++)
+      store_be32(p_ + (i * sizeof(u32)),src_[i]);
+  }
+
+  template<typename T>
+  struct FieldCodec;
+
+  template<>
+  struct FieldCodec<u8>
+  {
+    static constexpr std::size_t size = 1;
+
+    static constexpr void decode(const char *p_, u8 &v_) { v_ = static_cast<u8>(p_[0]); }
+    static constexpr void encode(char *p_, const u8 &v_) { p_[0] = static_cast<char>(v_); }
+  };
+
+  template<>
+  struct FieldCodec<u32>
+  {
+    static constexpr std::size_t size = sizeof(u32);
+
+    static constexpr void decode(const char *p_, u32 &v_) { v_ = load_be32(p_); }
+    static constexpr void encode(char *p_, const u32 &v_) { store_be32(p_,v_); }
+  };
+
+  template<>
+  struct FieldCodec<s32>
+  {
+    static constexpr std::size_t size = sizeof(s32);
+
+    static constexpr void decode(const char *p_, s32 &v_) { v_ = static_cast<s32>(load_be32(p_)); }
+    static constexpr void encode(char *p_, const s32 &v_) { store_be32(p_,static_cast<u32>(v_)); }
+  };
+
+  template<std::size_t N>
+  struct FieldCodec<char[N]>
+  {
+    static constexpr std::size_t size = N;
+
+    static constexpr
+    void
+    decode(const char *p_, char (&v_)[N])
+    {
+      for(std::size_t i = 0; i < N; i++)
+        v_[i] = p_[i];
+    }
+
+    static constexpr
+    void
+    encode(char *p_, const char (&v_)[N])
+    {
+      for(std::size_t i = 0; i < N; i++)
+        p_[i] = v_[i];
+    }
+  };
+
+  template<std::size_t N>
+  struct FieldCodec<std::array<char,N>>
+  {
+    static constexpr std::size_t size = N;
+
+    static constexpr
+    void
+    decode(const char *p_, std::array<char,N> &v_)
+    {
+      for(std::size_t i = 0; i < N; i++)
+        v_[i] = p_[i];
+    }
+
+    static constexpr
+    void
+    encode(char *p_, const std::array<char,N> &v_)
+    {
+      for(std::size_t i = 0; i < N; i++)
+        p_[i] = v_[i];
+    }
+  };
+
+  template<std::size_t N>
+  struct FieldCodec<u32[N]>
+  {
+    static constexpr std::size_t size = (N * sizeof(u32));
+
+    static constexpr void decode(const char *p_, u32 (&v_)[N]) { load_be32_array(p_,v_,N); }
+    static constexpr void encode(char *p_, const u32 (&v_)[N]) { store_be32_array(p_,v_,N); }
+  };
+
+  template<std::size_t N>
+  struct FieldCodec<std::array<u32,N>>
+  {
+    static constexpr std::size_t size = (N * sizeof(u32));
+
+    static constexpr void decode(const char *p_, std::array<u32,N> &v_) { load_be32_array(p_,v_.data(),N); }
+    static constexpr void encode(char *p_, const std::array<u32,N> &v_) { store_be32_array(p_,v_.data(),N); }
+  };
+
+  template<typename T>
+  struct MemberType;
+
+  template<typename S, typename M>
+  struct MemberType<M S::*>
+  {
+    using type = M;
+  };
+
+  template<auto MEMBER>
+  using FieldCodecOf = FieldCodec<typename MemberType<decltype(MEMBER)>::type>;
+
+  // An ordered list of members laid out back to back with no padding.
+  template<auto... MEMBERS>
+  struct Fields
+  {
+    static constexpr std::size_t size = (FieldCodecOf<MEMBERS>::size + ...);
+
+    template<typename S>
+    static constexpr
+    void
+    decode(const char *p_,
+           S          &s_)
+    {
+      std::size_t offset = 0;
+
+      ((FieldCodecOf<MEMBERS>::decode(p_ + offset,s_.*MEMBERS),
+        offset += FieldCodecOf<MEMBERS>::size),...);
+    }
+
+    template<typename S>
+    static constexpr
+    void
+    encode(char    *p_,
+           const S &s_)
+    {
+      std::size_t offset = 0;
+
+      ((FieldCodecOf<MEMBERS>::encode(p_ + offset,s_.*MEMBERS),
+        offset += FieldCodecOf<MEMBERS>::size),...);
+    }
+  };
+
+  template<typename T>
+  struct Layout;
+
+  template<>
+  struct Layout<TDO::DiscLabel>
+    : Fields<&TDO::DiscLabel::record_type,
+             &TDO::DiscLabel::volume_sync_bytes,
+             &TDO::DiscLabel::volume_structure_version,
+             &TDO::DiscLabel::volume_flags,
+             &TDO::DiscLabel::volume_commentary,
+             &TDO::DiscLabel::volume_identifier,
+             &TDO::DiscLabel::volume_unique_identifier,
+             &TDO::DiscLabel::volume_block_size,
+             &TDO::DiscLabel::volume_block_count,
+             &TDO::DiscLabel::root_unique_identifier,
+             &TDO::DiscLabel::root_directory_block_count,
+             &TDO::DiscLabel::root_directory_block_size,
+             &TDO::DiscLabel::root_directory_last_avatar_index,
+             &TDO::DiscLabel::root_directory_avatar_list>
+  {
+  };
+
+  template<>
+  struct Layout<TDO::DirectoryHeader>
+    : Fields<&TDO::DirectoryHeader::next_block,
+             &TDO::DirectoryHeader::prev_block,
+             &TDO::DirectoryHeader::flags,
+             &TDO::DirectoryHeader::first_free_byte,
+             &TDO::DirectoryHeader::first_entry_offset>
+  {
+  };
+
+  // The fixed portion only. avatar_list follows it on disc with
+  // last_avatar_index + 1 big-endian u32 entries.
+  template<>
+  struct Layout<TDO::DirectoryRecord>
+    : Fields<&TDO::DirectoryRecord::flags,
+             &TDO::DirectoryRecord::unique_identifier,
+             &TDO::DirectoryRecord::type,
+             &TDO::DirectoryRecord::block_size,
+             &TDO::DirectoryRecord::byte_count,
+             &TDO::DirectoryRecord::block_count,
+             &TDO::DirectoryRecord::burst,
+             &TDO::DirectoryRecord::gap,
+             &TDO::DirectoryRecord::filename,
+             &TDO::DirectoryRecord::last_avatar_index>
+  {
+  };
+
+  template<>
+  struct Layout<TDO::ROMTag>
+    : Fields<&TDO::ROMTag::sub_systype,
+             &TDO::ROMTag::type,
+             &TDO::ROMTag::version,
+             &TDO::ROMTag::revision,
+             &TDO::ROMTag::flags,
+             &TDO::ROMTag::type_specific,
+             &TDO::ROMTag::reserved1,
+             &TDO::ROMTag::reserved2,
+             &TDO::ROMTag::offset,
+             &TDO::ROMTag::size,
+             &TDO::ROMTag::reserved3>
+  {
+  };
+
+  template<>
+  struct Layout<TDO::LinkedMemFileEntry>
+    : Fields<&TDO::LinkedMemFileEntry::fingerprint,
+             &TDO::LinkedMemFileEntry::flink_offset,
+             &TDO::LinkedMemFileEntry::blink_offset,
+             &TDO::LinkedMemFileEntry::block_count,
+             &TDO::LinkedMemFileEntry::header_block_count,
+             &TDO::LinkedMemFileEntry::byte_count,
+             &TDO::LinkedMemFileEntry::unique_identifier,
+             &TDO::LinkedMemFileEntry::type,
+             &TDO::LinkedMemFileEntry::filename>
+  {
+  };
+
+  static_assert(Layout<TDO::DiscLabel>::size == 132);
+  static_assert(Layout<TDO::DirectoryHeader>::size == 20);
+  static_assert(Layout<TDO::DirectoryRecord>::size == 68);
+  static_assert(Layout<TDO::ROMTag>::size == 32);
+  static_assert(Layout<TDO::LinkedMemFileEntry>::size == 64);
+
+  template<typename T>
+  using Buffer = std::array<char,Layout<T>::size>;
+
+  template<typename T>
+  constexpr
+  void
+  decode(const char *p_,
+         T          &v_)
+  {
+    Layout<T>::decode(p_,v_);
+  }
+
+  template<typename T>
+  constexpr
+  void
+  encode(char    *p_,
+         const T &v_)
+  {
+    Layout<T>::encode(p_,v_);
+  }
+}
@@ -61,27 +61,46 @@ TDO::romtag_has_version_revision(const TDO::ROMTag &romtag_)
   return ((romtag_.version != 0) || (romtag_.revision != 0));
 }
 
-const TDO::ROMTagVersionRevisionFallback*
-TDO::find_romtag_version_revision_fallback(const u8                 type_,
-                                           const std::vector<char> &data_)
+bool
+TDO::has_romtag_version_revision_fallback(const u8 type_)
 {
-  md5_digest_t digest;
-  bool has_type = false;
-
   for(const auto &fallback : ROMTAG_VERSION_REVISION_FALLBACKS)
     if(fallback.type == type_)
-      {
-        has_type = true;
-        break;
-      }
-  if(!has_type)
-    return nullptr;
+      return true;
 
-  md5_calc(data_.data(),data_.size(),digest);
+  return false;
+}
+
+const TDO::ROMTagVersionRevisionFallback*
+TDO::find_romtag_version_revision_fallback(const u8           type_,
+                                           const md5_digest_t digest_)
+{
   for(const auto &fallback : ROMTAG_VERSION_REVISION_FALLBACKS)
     if((fallback.type == type_) &&
-       (std::memcmp(digest,fallback.md5,sizeof(md5_digest_t)) == 0))
+       (std::memcmp(digest_,fallback.md5,sizeof(md5_digest_t)) == 0))
       return &fallback;
 
   return nullptr;
 }
+
+const TDO::ROMTagVersionRevisionFallback*
+TDO::find_romtag_version_revision_fallback(const u8    type_,
+                                           const char *data_,
+                                           const u64   size_)
+{
+  md5_digest_t digest;
+
+  if(!has_romtag_version_revision_fallback(type_))
+    return nullptr;
+
+  md5_calc(data_,size_,digest);
+
+  return find_romtag_version_revision_fallback(type_,digest);
+}
+
+const TDO::ROMTagVersionRevisionFallback*
+TDO::find_romtag_version_revision_fallback(const u8                 type_,
+                                           const std::vector<char> &data_)
+{
+  return find_romtag_version_revision_fallback(type_,data_.data(),data_.size());
+}
@@ -37,7 +37,20 @@ namespace TDO
   bool
   romtag_has_version_revision(const TDO::ROMTag &romtag_);
 
+  const ROMTagVersionRevisionFallback*
+  find_romtag_version_revision_fallback(const u8    type_,
+                                        const char *data_,
+                                        const u64   size_);
+
   const ROMTagVersionRevisionFallback*
   find_romtag_version_revision_fallback(const u8                 type_,
                                         const std::vector<char> &data_);
+
+  // For callers that compute the payload's MD5 themselves.
+  bool
+  has_romtag_version_revision_fallback(const u8 type_);
+
+  const ROMTagVersionRevisionFallback*
+  find_romtag_version_revision_fallback(const u8           type_,
+                                        const md5_digest_t digest_);
 }
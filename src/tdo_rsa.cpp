@@ -1,11 +1,20 @@
 #include "tdo_rsa.hpp"
 
 #include "bigd.h"
+#include "error.hpp"
 #include "md5.h"
+#include "montgomery.hpp"
 #include "tdo_keys.hpp"
 
+// bigdigits.h declares a volatile qualified return type.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wignored-qualifiers"
+#include "bigdigits.h"
+#pragma GCC diagnostic pop
+
 #include <cstddef>
 #include <cstring>
+#include <string>
 
 namespace
 {
@@ -32,7 +41,7 @@ namespace
       0xd5,0xb1,0x94,0xc2,0x70,0xa3,0x05,0x93,0xa9,0xea,0x40,0x32,
       0xd0,0x03,0x8c,0xae,0x2d,
     };
-  static constexpr unsigned long DEVELOPMENT_KEY_EXPONENT = 65537;
+  static constexpr unsigned long RSA_PUBLIC_EXPONENT = 65537;
 }
 
 struct Bigd
@@ -80,38 +89,273 @@ struct Bigd
 
 namespace
 {
+  static constexpr std::size_t RSA512_NDIGITS = RSA512_SIG_SIZE / sizeof(DIGIT_T);
+
+  template<std::size_t LIMBS>
   static
-  bool
-  verify_with_modulus(const md5_digest_t digest_,
-                      const rsa512_sig_t sig_,
-                      const BIGD         modulus_)
+  Montgomery::UInt<LIMBS>
+  uint_from_bigd(const BIGD bd_)
   {
-    md5_digest_t digest;
-    Bigd exponent(bdNew());
-    Bigd recovered(bdNew());
-    Bigd signature(bdNew());
+    unsigned char octets[LIMBS * sizeof(u32)];
+
+    bdConvToOctets(bd_,octets,sizeof(octets));
+
+    return Montgomery::from_octets<LIMBS>(octets,sizeof(octets));
+  }
+
+  // Everything a public-exponent check needs for one modulus, parsed
+  // once per process. Contexts are immutable after construction so
+  // concurrent verifications can share them.
+  struct PublicKeyContext
+  {
+    Montgomery::Modulus<16> modulus;
+
+    PublicKeyContext(const BIGD modulus_)
+      : modulus(uint_from_bigd<16>(modulus_))
+    {
+    }
+
+    PublicKeyContext(const unsigned char *modulus_,
+                     const std::size_t    modulus_size_)
+      : modulus(Montgomery::from_octets<16>(modulus_,modulus_size_))
+    {
+    }
+  };
+
+  // The padded M1 message with an all zero digest. The digest occupies
+  // the trailing md5_digest_t bytes of the big-endian encoding.
+  struct MessageTemplate
+  {
+    unsigned char octets[RSA512_SIG_SIZE];
+
+    MessageTemplate()
+    {
+      md5_digest_t digest = {};
+      Bigd message(tdo_keys_m1_retail_message(digest));
+
+      bdConvToOctets(message,octets,sizeof(octets));
+    }
+  };
+
+  static
+  const MessageTemplate&
+  message_template()
+  {
+    static const MessageTemplate tmpl;
+
+    return tmpl;
+  }
+
+  static
+  void
+  padded_message(const md5_digest_t  digest_,
+                 unsigned char      *octets_)
+  {
+    std::memcpy(octets_,message_template().octets,RSA512_SIG_SIZE);
+    std::memcpy(octets_ + RSA512_SIG_SIZE - sizeof(md5_digest_t),
+                digest_,
+                sizeof(md5_digest_t));
+  }
+
+  static
+  const PublicKeyContext&
+  retail_key_context(const char *key_)
+  {
+    static const PublicKeyContext key_3do(Bigd(tdo_keys_n(TDO_KEY_3DO)));
+    static const PublicKeyContext key_app(Bigd(tdo_keys_n(TDO_KEY_APP)));
+
+    if(std::strcmp(key_,TDO_KEY_3DO) == 0)
+      return key_3do;
+    if(std::strcmp(key_,TDO_KEY_APP) == 0)
+      return key_app;
+
+    throw Error("unknown key: " + std::string(key_));
+  }
+
+  static
+  const PublicKeyContext&
+  demo_key_context()
+  {
+    static const PublicKeyContext ctx(DEMO_KEY_MODULUS,
+                                      sizeof(DEMO_KEY_MODULUS));
+
+    return ctx;
+  }
+
+  static
+  const PublicKeyContext&
+  engineering_key_context()
+  {
+    static const PublicKeyContext ctx(ENGINEERING_KEY_MODULUS,
+                                      sizeof(ENGINEERING_KEY_MODULUS));
 
+    return ctx;
+  }
+
+  // The Chinese Remainder Theorem form of a retail private key. Both
+  // exponentiations run against 256 bit primes rather than the 512
+  // bit modulus which is roughly four times less work than m^d mod n.
+  // Built once per key per process and immutable afterwards.
+  struct PrivateKeyContext
+  {
+    Montgomery::Modulus<8> p;
+    Montgomery::Modulus<8> q;
+    Montgomery::UInt256    dp;
+    Montgomery::UInt256    dq;
+    Montgomery::UInt256    qinv;
+
+    PrivateKeyContext(const BIGD p_,
+                      const BIGD q_,
+                      const BIGD d_)
+      : p(uint_from_bigd<8>(p_)),
+        q(uint_from_bigd<8>(q_))
+    {
+      Bigd pm1(bdNew());
+      Bigd qm1(bdNew());
+      Bigd bdp(bdNew());
+      Bigd bdq(bdNew());
+      Bigd bqinv(bdNew());
+
+      bdShortSub(pm1,p_,1);
+      bdShortSub(qm1,q_,1);
+      bdModulo(bdp,d_,pm1);
+      bdModulo(bdq,d_,qm1);
+      bdModInv(bqinv,q_,p_);
+
+      dp   = uint_from_bigd<8>(bdp);
+      dq   = uint_from_bigd<8>(bdq);
+      qinv = uint_from_bigd<8>(bqinv);
+    }
+
+    PrivateKeyContext(const char *key_)
+      : PrivateKeyContext(Bigd(tdo_keys_p(key_)),
+                          Bigd(tdo_keys_q(key_)),
+                          Bigd(tdo_keys_d(key_)))
+    {
+    }
+  };
+
+  static
+  const PrivateKeyContext&
+  retail_private_key_context(const char *key_)
+  {
+    static const PrivateKeyContext key_3do(TDO_KEY_3DO);
+    static const PrivateKeyContext key_app(TDO_KEY_APP);
+
+    if(std::strcmp(key_,TDO_KEY_3DO) == 0)
+      return key_3do;
+    if(std::strcmp(key_,TDO_KEY_APP) == 0)
+      return key_app;
+
+    throw Error("unknown key: " + std::string(key_));
+  }
+
+  // s = m2 + q * (qInv * (m1 - m2) mod p) with m1 = m^dP mod p and
+  // m2 = m^dQ mod q (Garner). The message is below n = p * q so it
+  // can be reduced directly by either prime.
+  static
+  void
+  sign_crt(const PrivateKeyContext &ctx_,
+           const md5_digest_t       digest_,
+           rsa512_sig_t             sig_)
+  {
+    unsigned char octets[RSA512_SIG_SIZE];
+
+    padded_message(digest_,octets);
+
+    const auto message = Montgomery::from_octets<16>(octets,sizeof(octets));
+    const auto m1 = ctx_.p.exp(ctx_.p.reduce(message),ctx_.dp);
+    const auto m2 = ctx_.q.exp(ctx_.q.reduce(message),ctx_.dq);
+    const auto m2p = ctx_.p.reduce(Montgomery::widen(m2));
+    const auto h = ctx_.p.mod_mul(ctx_.p.mod_sub(m1,m2p),ctx_.qinv);
+
+    auto signature = Montgomery::multiply(h,ctx_.q.modulus());
+    Montgomery::add(signature,Montgomery::widen(m2));
+
+    Montgomery::to_octets(signature,sig_,sizeof(rsa512_sig_t));
+  }
+
+#if defined(TDO_RSA_SELFTEST)
+  // Reference implementations on top of bigdigits. Builds made with
+  // RSA_SELFTEST=1 cross-check every result of the fixed width code
+  // against these.
+  static
+  void
+  sign_slow(const char         *key_,
+            const md5_digest_t  digest_,
+            rsa512_sig_t        sig_)
+  {
+    md5_digest_t digest;
     std::memcpy(digest,digest_,sizeof(digest));
-    Bigd expected(tdo_keys_m1_retail_message(digest));
-    bdSetShort(exponent,DEVELOPMENT_KEY_EXPONENT);
-    bdConvFromOctets(signature,sig_,sizeof(rsa512_sig_t));
-    bdModExp(recovered,signature,exponent,modulus_);
 
-    return (bdIsEqual(recovered,expected) != 0);
+    Bigd n(tdo_keys_n(key_));
+    Bigd d(tdo_keys_d(key_));
+    Bigd m(tdo_keys_m(key_,digest));
+    Bigd s(bdNew());
+
+    bdModExp(s,m,d,n);
+
+    bdConvToOctets(s,sig_,sizeof(rsa512_sig_t));
+  }
+
+  static
+  void
+  recover_slow(const PublicKeyContext &ctx_,
+               const rsa512_sig_t      sig_,
+               unsigned char          *octets_)
+  {
+    DIGIT_T modulus[RSA512_NDIGITS];
+    DIGIT_T exponent[RSA512_NDIGITS];
+    DIGIT_T signature[RSA512_NDIGITS];
+    DIGIT_T recovered[RSA512_NDIGITS];
+    unsigned char modulus_octets[RSA512_SIG_SIZE];
+
+    Montgomery::to_octets(ctx_.modulus.modulus(),
+                          modulus_octets,
+                          sizeof(modulus_octets));
+    mpConvFromOctets(modulus,RSA512_NDIGITS,modulus_octets,sizeof(modulus_octets));
+    mpSetDigit(exponent,RSA_PUBLIC_EXPONENT,RSA512_NDIGITS);
+    mpConvFromOctets(signature,RSA512_NDIGITS,sig_,sizeof(rsa512_sig_t));
+    mpModExp(recovered,signature,exponent,modulus,RSA512_NDIGITS);
+    mpConvToOctets(recovered,RSA512_NDIGITS,octets_,RSA512_SIG_SIZE);
   }
+#endif
 
+  // sig^e mod n must reproduce the padded message. When
+  // require_reduced_ is set the signature must also be below the
+  // modulus, which makes the check equivalent to re-signing with the
+  // private key and comparing bytes.
   static
   bool
-  verify_with_public_key(const md5_digest_t  digest_,
-                         const rsa512_sig_t  sig_,
-                         const unsigned char *modulus_,
-                         const std::size_t    modulus_size_)
+  verify_with_context(const PublicKeyContext &ctx_,
+                      const md5_digest_t      digest_,
+                      const rsa512_sig_t      sig_,
+                      const bool              require_reduced_)
   {
-    Bigd modulus(bdNew());
+    unsigned char expected[RSA512_SIG_SIZE];
+    unsigned char recovered_octets[RSA512_SIG_SIZE];
+
+    const auto signature =
+      Montgomery::from_octets<16>(sig_,sizeof(rsa512_sig_t));
+    if(require_reduced_ &&
+       (Montgomery::compare(signature,ctx_.modulus.modulus()) >= 0))
+      return false;
 
-    bdConvFromOctets(modulus,modulus_,modulus_size_);
+    const auto recovered =
+      ctx_.modulus.exp(signature,(u32)RSA_PUBLIC_EXPONENT);
+    Montgomery::to_octets(recovered,recovered_octets,sizeof(recovered_octets));
 
-    return verify_with_modulus(digest_,sig_,modulus);
+#if defined(TDO_RSA_SELFTEST)
+    unsigned char reference[RSA512_SIG_SIZE];
+
+    recover_slow(ctx_,sig_,reference);
+    if(std::memcmp(recovered_octets,reference,sizeof(reference)) != 0)
+      throw Error("RSA recovery does not match reference implementation");
+#endif
+
+    padded_message(digest_,expected);
+
+    return (std::memcmp(recovered_octets,expected,sizeof(expected)) == 0);
   }
 }
 
@@ -120,17 +364,15 @@ tdo_rsa_sign(const char         *key_,
              const md5_digest_t  digest_,
              rsa512_sig_t        sig_)
 {
-  md5_digest_t digest;
-  std::memcpy(digest,digest_,sizeof(digest));
+  sign_crt(retail_private_key_context(key_),digest_,sig_);
 
-  Bigd n(tdo_keys_n(key_));
-  Bigd d(tdo_keys_d(key_));
-  Bigd m(tdo_keys_m(key_,digest));
-  Bigd s(bdNew());
+#if defined(TDO_RSA_SELFTEST)
+  rsa512_sig_t expected;
 
-  bdModExp(s,m,d,n);
-
-  bdConvToOctets(s,sig_,sizeof(rsa512_sig_t));
+  sign_slow(key_,digest_,expected);
+  if(std::memcmp(sig_,expected,sizeof(rsa512_sig_t)) != 0)
+    throw Error("RSA signature does not match reference implementation");
+#endif
 }
 
 bool
@@ -138,21 +380,13 @@ tdo_rsa_verify_retail(const char         *key_,
                       const md5_digest_t  digest_,
                       const rsa512_sig_t  sig_)
 {
-  Bigd modulus(tdo_keys_n(key_));
-
-  return verify_with_modulus(digest_,sig_,modulus);
+  return verify_with_context(retail_key_context(key_),digest_,sig_,true);
 }
 
 bool
 tdo_rsa_verify_development(const md5_digest_t digest_,
                            const rsa512_sig_t sig_)
 {
-  return (verify_with_public_key(digest_,
-                                 sig_,
-                                 DEMO_KEY_MODULUS,
-                                 sizeof(DEMO_KEY_MODULUS)) ||
-          verify_with_public_key(digest_,
-                                 sig_,
-                                 ENGINEERING_KEY_MODULUS,
-                                 sizeof(ENGINEERING_KEY_MODULUS)));
+  return (verify_with_context(demo_key_context(),digest_,sig_,false) ||
+          verify_with_context(engineering_key_context(),digest_,sig_,false));
 }